@@ -51,6 +51,19 @@ cpucheck = $(shell cat /proc/cpuinfo | grep " $(1) " | awk  \
     "END{if (NR>1) print \"AUTOFLAGS+=$(2)\";}"             \
     >> $(BIN_DIR)/config.mk)
 
+# Binaries built with PORTABLE=1 run on any x86-64 CPU with SSE4.1, instead
+# of requiring the extensions of the build host. Wider SIMD kernels are then
+# picked at runtime, see lib/cpu-features.h. Run "make clean" when switching.
+ifneq "$(PORTABLE)" ""
+    AUTOFLAGS:=-msse4.1
+endif
+
+# Binaries built with MAP_HASH64=1 store 64-bit hashes in "map" and "cmap",
+# see lib/hash.h. Run "make clean" when switching.
+ifneq "$(MAP_HASH64)" ""
+    CFLAGS+=-DMAP_HASH64
+endif
+
 # Create bin directory, configure AUTOFLAGS (if empty!)
 ifeq "$(wildcard $(BIN_DIR) )" ""
     $(shell mkdir $(BIN_DIR))
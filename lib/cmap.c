@@ -132,6 +132,15 @@ cmap_init(struct cmap *cmap)
     struct cmap_impl *impl = cmap_impl_init(MAP_INITIAL_SIZE);
     cmap->impl = xmalloc(sizeof(*cmap->impl));
     rcu_init(cmap->impl->p, impl);
+    cmap->keyed = false;
+}
+
+void
+cmap_init_keyed(struct cmap *cmap)
+{
+    cmap_init(cmap);
+    hash_key_init_random(&cmap->key);
+    cmap->keyed = true;
 }
 
 void
@@ -182,7 +191,7 @@ cmap_is_empty(const struct cmap *cmap)
 
 /* Only one concurrent writer */
 size_t
-cmap_insert(struct cmap *cmap, struct cmap_node *node, uint32_t hash)
+cmap_insert(struct cmap *cmap, struct cmap_node *node, map_hash_t hash)
 {
     struct rcu *impl_rcu;
     struct cmap_impl *impl;
@@ -248,8 +257,20 @@ cmap_state_release(struct cmap_state state) {
 }
 
 
+#ifdef MAP_HASH64
+/* Returns "node" or the first node after it with "hash" */
+static inline struct cmap_node *
+cmap_skip__(struct cmap_node *node, map_hash_t hash)
+{
+    while (node && node->hash != hash) {
+        node = node->next;
+    }
+    return node;
+}
+#endif
+
 struct cmap_cursor
-cmap_find__(struct cmap_state state, uint32_t hash)
+cmap_find__(struct cmap_state state, map_hash_t hash)
 {
     struct cmap_impl *impl;
     struct cmap_cursor cursor;
@@ -265,6 +286,10 @@ cmap_find__(struct cmap_state state, uint32_t hash)
     cursor.node = impl->arr[cursor.entry_idx].first;
     cursor.next = NULL;
     cursor.accross_entries = false;
+#ifdef MAP_HASH64
+    cursor.hash = hash;
+    cursor.node = cmap_skip__(cursor.node, hash);
+#endif
     if (cursor.node) {
         cursor.next = cursor.node->next;
     }
@@ -276,6 +301,11 @@ cmap_start__(struct cmap_state state)
 {
     struct cmap_cursor cursor = cmap_find__(state, 0);
     cursor.accross_entries = true;
+#ifdef MAP_HASH64
+    /* Visit all nodes of the first entry, not only those with hash 0 */
+    cursor.node = NULL;
+    cursor.next = rcu_get(state.p, struct cmap_impl*)->arr[0].first;
+#endif
     /* Don't start with an empty node */
     if (!cursor.node) {
         cmap_next__(state, &cursor);
@@ -290,6 +320,11 @@ cmap_next__(struct cmap_state state, struct cmap_cursor *cursor)
     impl = rcu_get(state.p, struct cmap_impl*);
 
     cursor->node = cursor->next;
+#ifdef MAP_HASH64
+    if (!cursor->accross_entries) {
+        cursor->node = cmap_skip__(cursor->node, cursor->hash);
+    }
+#endif
     if (cursor->node) {
         cursor->next = cursor->node->next;
         return;
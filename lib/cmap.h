@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "util.h"
+#include "hash.h"
 #include "rcu.h"
 
 #ifdef __cplusplus
@@ -17,7 +18,7 @@ extern "C" {
 
 struct cmap_node {
     struct cmap_node *next; /* Next node with same hash. */
-    uint32_t hash;
+    map_hash_t hash;
 };
 
 /* Used for going over all cmap nodes */
@@ -26,6 +27,9 @@ struct cmap_cursor {
     struct cmap_node *next; /* Pointer to cmap_node */
     size_t entry_idx;      /* Current entry */
     bool accross_entries;  /* Hold cursor accross cmap entries */
+#ifdef MAP_HASH64
+    map_hash_t hash;       /* Only nodes with this hash, unless accross */
+#endif
 };
 
 /* Map state (snapshot), must be acquired before cmap iteration, and released
@@ -37,19 +41,52 @@ struct cmap_state {
 /* Concurrent hash cmap. */
 struct cmap {
     struct cmap_state *impl;
+    struct hash_key key;   /* Secret of "cmap_hash_*", if "keyed" */
+    bool keyed;
 };
 
-/* Initialization. */
+/* Initialization. "cmap_init_keyed" draws a random secret for the
+ * "cmap_hash_*" functions, for tables whose keys come from untrusted
+ * sources. */
 void cmap_init(struct cmap *);
+void cmap_init_keyed(struct cmap *);
 void cmap_destroy(struct cmap *);
 
+/* Hashes a key for insertion or lookup: with SipHash under the secret of a
+ * keyed table, or with the default hash otherwise. */
+static inline map_hash_t
+cmap_hash_bytes(const struct cmap *cmap, const void *p, size_t n)
+{
+    if (cmap->keyed) {
+        return hash_siphash(p, n, &cmap->key);
+    }
+#ifdef MAP_HASH64
+    return hash64_bytes(p, n, 0);
+#else
+    return hash_bytes(p, n, 0);
+#endif
+}
+
+static inline map_hash_t
+cmap_hash_uint64(const struct cmap *cmap, uint64_t x)
+{
+    if (cmap->keyed) {
+        return hash_siphash_uint64(x, &cmap->key);
+    }
+#ifdef MAP_HASH64
+    return hash64_uint64(x, 0);
+#else
+    return hash_uint64(x);
+#endif
+}
+
 /* Counters. */
 size_t cmap_size(const struct cmap *);
 bool cmap_is_empty(const struct cmap *);
 double cmap_utilization(const struct cmap *cmap);
 
 /* Insertion and deletion. Return the current count after the operation. */
-size_t cmap_insert(struct cmap *, struct cmap_node *, uint32_t hash);
+size_t cmap_insert(struct cmap *, struct cmap_node *, map_hash_t hash);
 size_t cmap_remove(struct cmap *, struct cmap_node *);
 
 /* Acquire/release cmap concurrent state. Use with iteration macros.
@@ -72,12 +109,15 @@ void cmap_state_release(struct cmap_state state);
 #define MAP_FOR_EACH(NODE, MEMBER, STATE) \
     MAP_FOR_EACH__(NODE, MEMBER, MAP, cmap_start__(STATE), STATE)
 
+/* Visits the nodes in the bucket of "HASH". With MAP_HASH64, skips nodes
+ * whose hash differs, so the bits above the bucket index act as a tag that
+ * rejects most collisions before the caller compares keys. */
 #define MAP_FOR_EACH_WITH_HASH(NODE, MEMBER, HASH, STATE) \
     MAP_FOR_EACH__(NODE, MEMBER, MAP, cmap_find__(STATE, HASH), STATE)
 
 /* Ieration, private methods. Use iteration macros instead */
 struct cmap_cursor cmap_start__(struct cmap_state state);
-struct cmap_cursor cmap_find__(struct cmap_state state, uint32_t hash);
+struct cmap_cursor cmap_find__(struct cmap_state state, map_hash_t hash);
 void cmap_next__(struct cmap_state state, struct cmap_cursor *cursor);
 
 #define MAP_FOR_EACH__(NODE, MEMBER, MAP, START, STATE)                 \
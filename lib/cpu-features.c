@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "cpu-features.h"
+
+#ifdef CPU_FEATURES_X86
+#include <cpuid.h>
+
+/* XCR0 bits of the register state the OS saves on context switches */
+#define XCR0_SSE       (1 << 1)
+#define XCR0_AVX       (1 << 2)
+#define XCR0_AVX512    (7 << 5)    /* Opmask, ZMM0-15 high, ZMM16-31 */
+
+/* Without the "xsave" target, as "_xgetbv" would require it */
+static uint64_t
+xgetbv(uint32_t index)
+{
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return (uint64_t)edx << 32 | eax;
+}
+
+static uint32_t
+cpu_features_detect(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    uint32_t features = 0;
+    uint64_t xcr0 = 0;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    features |= edx & bit_SSE2 ? CPU_FEATURE_SSE2 : 0;
+    features |= ecx & bit_SSE3 ? CPU_FEATURE_SSE3 : 0;
+    features |= ecx & bit_SSSE3 ? CPU_FEATURE_SSSE3 : 0;
+    features |= ecx & bit_SSE4_1 ? CPU_FEATURE_SSE4_1 : 0;
+    features |= ecx & bit_SSE4_2 ? CPU_FEATURE_SSE4_2 : 0;
+    features |= ecx & bit_POPCNT ? CPU_FEATURE_POPCNT : 0;
+    if (ecx & bit_OSXSAVE) {
+        xcr0 = xgetbv(0);
+    }
+
+    /* The AVX family also needs the OS to save YMM, and ZMM, registers */
+    if ((xcr0 & (XCR0_SSE | XCR0_AVX)) != (XCR0_SSE | XCR0_AVX)) {
+        return features;
+    }
+    features |= ecx & bit_AVX ? CPU_FEATURE_AVX : 0;
+    features |= ecx & bit_FMA ? CPU_FEATURE_FMA : 0;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return features;
+    }
+    features |= ebx & bit_AVX2 ? CPU_FEATURE_AVX2 : 0;
+    features |= ebx & bit_BMI2 ? CPU_FEATURE_BMI2 : 0;
+    if ((xcr0 & XCR0_AVX512) == XCR0_AVX512) {
+        features |= ebx & bit_AVX512F ? CPU_FEATURE_AVX512F : 0;
+        features |= ebx & bit_AVX512BW ? CPU_FEATURE_AVX512BW : 0;
+        features |= ebx & bit_AVX512VL ? CPU_FEATURE_AVX512VL : 0;
+    }
+    return features;
+}
+#else
+static uint32_t
+cpu_features_detect(void)
+{
+    return 0;
+}
+#endif
+
+atomic_uint cpu_features_cache__;
+
+/* Every thread that races here stores the same value */
+uint32_t
+cpu_features_detect__(void)
+{
+    uint32_t features = cpu_features_detect() | CPU_FEATURES_DETECTED;
+    atomic_store_explicit(&cpu_features_cache__, features,
+                          memory_order_relaxed);
+    return features;
+}
+
+const char *
+cpu_feature_name(enum cpu_feature feature)
+{
+    static const char *names[CPU_FEATURES_NUM] = {
+        "sse2", "sse3", "ssse3", "sse4.1", "sse4.2", "popcnt", "avx", "fma",
+        "avx2", "bmi2", "avx512f", "avx512bw", "avx512vl"
+    };
+
+    for (int i = 0; i < CPU_FEATURES_NUM; i++) {
+        if (feature == 1u << i) {
+            return names[i];
+        }
+    }
+    return "unknown";
+}
+
+void
+cpu_features_print(FILE *dst)
+{
+    uint32_t features = cpu_features();
+
+    fprintf(dst, "CPU features:");
+    for (int i = 0; i < CPU_FEATURES_NUM; i++) {
+        if (features & 1u << i) {
+            fprintf(dst, " %s", cpu_feature_name(1u << i));
+        }
+    }
+    fprintf(dst, features ? "\n" : " none\n");
+}
@@ -0,0 +1,75 @@
+#ifndef _CPU_FEATURES_H
+#define _CPU_FEATURES_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Instruction set extensions of the running CPU, for picking SIMD kernels
+ * at runtime rather than at build time. A feature is reported only when
+ * both the CPU and the OS support it, i.e., AVX and AVX-512 also require
+ * the OS to save their registers (XCR0). Always 0 on other architectures
+ * than x86-64. */
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CPU_FEATURES_X86 1
+#endif
+
+enum cpu_feature {
+    CPU_FEATURE_SSE2     = 1 << 0,
+    CPU_FEATURE_SSE3     = 1 << 1,
+    CPU_FEATURE_SSSE3    = 1 << 2,
+    CPU_FEATURE_SSE4_1   = 1 << 3,
+    CPU_FEATURE_SSE4_2   = 1 << 4,
+    CPU_FEATURE_POPCNT   = 1 << 5,
+    CPU_FEATURE_AVX      = 1 << 6,
+    CPU_FEATURE_FMA      = 1 << 7,
+    CPU_FEATURE_AVX2     = 1 << 8,
+    CPU_FEATURE_BMI2     = 1 << 9,
+    CPU_FEATURE_AVX512F  = 1 << 10,
+    CPU_FEATURE_AVX512BW = 1 << 11,
+    CPU_FEATURE_AVX512VL = 1 << 12,
+    CPU_FEATURES_NUM     = 13
+};
+
+/* Set once the cached value is valid */
+#define CPU_FEATURES_DETECTED (1u << 31)
+
+extern atomic_uint cpu_features_cache__;
+uint32_t cpu_features_detect__(void);
+
+/* Returns the "cpu_feature" bits of the running CPU. Detected on first
+ * use, then cached. */
+static inline uint32_t
+cpu_features(void)
+{
+    uint32_t features = atomic_load_explicit(&cpu_features_cache__,
+                                             memory_order_relaxed);
+    if (!features) {
+        features = cpu_features_detect__();
+    }
+    return features & ~CPU_FEATURES_DETECTED;
+}
+
+/* True if the running CPU supports all of "features" */
+static inline bool
+cpu_has(uint32_t features)
+{
+    return (cpu_features() & features) == features;
+}
+
+/* Returns the lowercase name of a single feature, e.g., "avx2" */
+const char *cpu_feature_name(enum cpu_feature feature);
+
+void cpu_features_print(FILE *dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
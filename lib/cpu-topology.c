@@ -0,0 +1,567 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "util.h"
+#include "cpu-topology.h"
+
+#define CPU_TOPOLOGY_ROOT "/sys/devices/system"
+
+/* Large enough for any sysfs attribute we read, including CPU lists of
+ * machines with thousands of CPUs */
+#define CPU_TOPOLOGY_LINE 8192
+
+/* Reads the first line of a sysfs file into "buf" without its newline.
+ * Returns false if the file cannot be read or is empty. */
+static bool
+read_line(const char *path, char *buf, size_t size)
+{
+    FILE *file = fopen(path, "r");
+    size_t len;
+
+    if (!file) {
+        return false;
+    }
+    if (!fgets(buf, size, file)) {
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+    len = strcspn(buf, "\n");
+    buf[len] = '\0';
+    return len > 0;
+}
+
+static int
+read_int(const char *path, int default_value)
+{
+    char buf[64];
+    char *end;
+    long value;
+
+    if (!read_line(path, buf, sizeof(buf))) {
+        return default_value;
+    }
+    value = strtol(buf, &end, 10);
+    return end == buf ? default_value : (int)value;
+}
+
+/* Parses a list such as "0-3,8,10-11" into "cpus" (if not NULL) up to "max"
+ * entries. Returns the number of CPUs in the list, or -1 if malformed. */
+static int
+parse_cpu_list(const char *str, int *cpus, int max)
+{
+    const char *p = str;
+    int count = 0;
+    char *end;
+
+    while (*p) {
+        long first, last;
+        first = strtol(p, &end, 10);
+        if (end == p || first < 0) {
+            return -1;
+        }
+        last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) {
+                return -1;
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (cpus && count < max) {
+                cpus[count] = cpu;
+            }
+            count++;
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p) {
+            return -1;
+        }
+    }
+    return count;
+}
+
+/* Parses sizes such as "32K" or "1M" */
+static size_t
+parse_size(const char *str)
+{
+    char *end;
+    size_t size = strtoull(str, &end, 10);
+
+    switch (*end) {
+    case 'K': return size << 10;
+    case 'M': return size << 20;
+    case 'G': return size << 30;
+    default: return size;
+    }
+}
+
+static int
+cpu_info_index(const struct cpu_topology *topo, int cpu)
+{
+    for (int i = 0; i < topo->num_cpus; i++) {
+        if (topo->cpus[i].cpu == cpu) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void
+read_online(struct cpu_topology *topo, const char *root)
+{
+    char path[256];
+    char *buf = xmalloc(CPU_TOPOLOGY_LINE);
+    int *cpus = NULL;
+    int count = -1;
+
+    snprintf(path, sizeof(path), "%s/cpu/online", root);
+    if (read_line(path, buf, CPU_TOPOLOGY_LINE)) {
+        count = parse_cpu_list(buf, NULL, 0);
+    }
+    if (count > 0) {
+        cpus = xmalloc(count * sizeof(*cpus));
+        parse_cpu_list(buf, cpus, count);
+    } else {
+        count = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+        cpus = xmalloc(count * sizeof(*cpus));
+        for (int i = 0; i < count; i++) {
+            cpus[i] = i;
+        }
+    }
+
+    topo->num_cpus = count;
+    topo->cpus = xmalloc(count * sizeof(*topo->cpus));
+    for (int i = 0; i < count; i++) {
+        topo->cpus[i].cpu = cpus[i];
+        topo->cpus[i].core = -1;
+        topo->cpus[i].package = 0;
+        topo->cpus[i].node = -1;
+        topo->cpus[i].smt = 0;
+    }
+    free(cpus);
+    free(buf);
+}
+
+/* Returns the NUMA node of "cpu" from its "nodeN" link, or -1 */
+static int
+read_cpu_node(const char *root, int cpu)
+{
+    char path[256];
+    struct dirent *entry;
+    DIR *dir;
+    int node = -1;
+
+    snprintf(path, sizeof(path), "%s/cpu/cpu%d", root, cpu);
+    dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+    while ((entry = readdir(dir))) {
+        if (sscanf(entry->d_name, "node%d", &node) == 1) {
+            break;
+        }
+        node = -1;
+    }
+    closedir(dir);
+    return node;
+}
+
+/* Fills nodes that "read_cpu_node" missed from "root"/node/nodeN/cpulist */
+static void
+read_node_lists(struct cpu_topology *topo, const char *root)
+{
+    char path[512];
+    char *buf;
+    struct dirent *entry;
+    DIR *dir;
+    int *cpus;
+
+    snprintf(path, sizeof(path), "%s/node", root);
+    dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+
+    buf = xmalloc(CPU_TOPOLOGY_LINE);
+    while ((entry = readdir(dir))) {
+        int node, count;
+        if (sscanf(entry->d_name, "node%d", &node) != 1) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/node/%s/cpulist", root,
+                 entry->d_name);
+        if (!read_line(path, buf, CPU_TOPOLOGY_LINE)) {
+            continue;
+        }
+        count = parse_cpu_list(buf, NULL, 0);
+        if (count <= 0) {
+            continue;
+        }
+        cpus = xmalloc(count * sizeof(*cpus));
+        parse_cpu_list(buf, cpus, count);
+        for (int i = 0; i < count; i++) {
+            int idx = cpu_info_index(topo, cpus[i]);
+            if (idx >= 0 && topo->cpus[idx].node < 0) {
+                topo->cpus[idx].node = node;
+            }
+        }
+        free(cpus);
+    }
+    free(buf);
+    closedir(dir);
+}
+
+/* Assigns physical cores and SMT indices. Siblings are identified by the
+ * first CPU of "thread_siblings_list", or else by their package and
+ * "core_id". */
+static void
+read_cores(struct cpu_topology *topo, const char *root)
+{
+    char path[256];
+    char buf[256];
+    int *leader = xmalloc(topo->num_cpus * sizeof(*leader));
+    int *core_id = xmalloc(topo->num_cpus * sizeof(*core_id));
+
+    for (int i = 0; i < topo->num_cpus; i++) {
+        struct cpu_info *info = &topo->cpus[i];
+        int first;
+
+        snprintf(path, sizeof(path),
+                 "%s/cpu/cpu%d/topology/physical_package_id", root, info->cpu);
+        info->package = MAX(read_int(path, 0), 0);
+        snprintf(path, sizeof(path), "%s/cpu/cpu%d/topology/core_id",
+                 root, info->cpu);
+        core_id[i] = read_int(path, -1);
+
+        leader[i] = info->cpu;
+        snprintf(path, sizeof(path),
+                 "%s/cpu/cpu%d/topology/thread_siblings_list", root, info->cpu);
+        if (read_line(path, buf, sizeof(buf)) &&
+            parse_cpu_list(buf, &first, 1) > 0) {
+            leader[i] = first;
+            continue;
+        }
+        if (core_id[i] < 0) {
+            continue;
+        }
+        for (int j = 0; j < i; j++) {
+            if (core_id[j] == core_id[i] &&
+                topo->cpus[j].package == info->package) {
+                leader[i] = leader[j];
+                break;
+            }
+        }
+    }
+
+    topo->num_cores = 0;
+    for (int i = 0; i < topo->num_cpus; i++) {
+        struct cpu_info *info = &topo->cpus[i];
+        for (int j = 0; j < i; j++) {
+            if (leader[j] == leader[i]) {
+                info->core = topo->cpus[j].core;
+                info->smt++;
+            }
+        }
+        if (info->core < 0) {
+            info->core = topo->num_cores++;
+        }
+    }
+
+    free(core_id);
+    free(leader);
+}
+
+static void
+read_caches(struct cpu_topology *topo, const char *root)
+{
+    static const struct {
+        int name;
+        int line_name;
+        int level;
+        enum cpu_cache_type type;
+    } fallback[] = {
+        { _SC_LEVEL1_DCACHE_SIZE, _SC_LEVEL1_DCACHE_LINESIZE, 1,
+          CPU_CACHE_DATA },
+        { _SC_LEVEL2_CACHE_SIZE, _SC_LEVEL2_CACHE_LINESIZE, 2,
+          CPU_CACHE_UNIFIED },
+        { _SC_LEVEL3_CACHE_SIZE, _SC_LEVEL3_CACHE_LINESIZE, 3,
+          CPU_CACHE_UNIFIED },
+    };
+    char path[256];
+    char *buf = xmalloc(CPU_TOPOLOGY_LINE);
+    int cpu = topo->cpus[0].cpu;
+
+    topo->num_caches = 0;
+    for (int i = 0; i < CPU_TOPOLOGY_MAX_CACHES; i++) {
+        struct cpu_cache *cache = &topo->caches[topo->num_caches];
+
+        snprintf(path, sizeof(path), "%s/cpu/cpu%d/cache/index%d/level",
+                 root, cpu, i);
+        cache->level = read_int(path, -1);
+        if (cache->level < 0) {
+            break;
+        }
+
+        cache->type = CPU_CACHE_UNKNOWN;
+        snprintf(path, sizeof(path), "%s/cpu/cpu%d/cache/index%d/type",
+                 root, cpu, i);
+        if (read_line(path, buf, CPU_TOPOLOGY_LINE)) {
+            cache->type = !strcmp(buf, "Data") ? CPU_CACHE_DATA :
+                          !strcmp(buf, "Instruction") ? CPU_CACHE_INSTRUCTION :
+                          !strcmp(buf, "Unified") ? CPU_CACHE_UNIFIED :
+                          CPU_CACHE_UNKNOWN;
+        }
+
+        snprintf(path, sizeof(path), "%s/cpu/cpu%d/cache/index%d/size",
+                 root, cpu, i);
+        cache->size = read_line(path, buf, CPU_TOPOLOGY_LINE)
+                      ? parse_size(buf) : 0;
+
+        snprintf(path, sizeof(path),
+                 "%s/cpu/cpu%d/cache/index%d/coherency_line_size",
+                 root, cpu, i);
+        cache->line_size = MAX(read_int(path, 0), 0);
+
+        snprintf(path, sizeof(path),
+                 "%s/cpu/cpu%d/cache/index%d/shared_cpu_list", root, cpu, i);
+        cache->shared = read_line(path, buf, CPU_TOPOLOGY_LINE)
+                        ? MAX(parse_cpu_list(buf, NULL, 0), 0) : 0;
+        topo->num_caches++;
+    }
+    free(buf);
+
+    if (topo->num_caches) {
+        return;
+    }
+    for (size_t i = 0; i < sizeof(fallback) / sizeof(*fallback); i++) {
+        long size = sysconf(fallback[i].name);
+        long line_size = sysconf(fallback[i].line_name);
+        struct cpu_cache *cache = &topo->caches[topo->num_caches];
+        if (size <= 0) {
+            continue;
+        }
+        cache->level = fallback[i].level;
+        cache->type = fallback[i].type;
+        cache->size = size;
+        cache->line_size = MAX(line_size, 0);
+        cache->shared = 0;
+        topo->num_caches++;
+    }
+}
+
+/* Counts distinct values of an int member of "cpus" */
+#define COUNT_DISTINCT(TOPO, MEMBER, RESULT)                             \
+    do {                                                                 \
+        (RESULT) = 0;                                                    \
+        for (int i__ = 0; i__ < (TOPO)->num_cpus; i__++) {               \
+            int j__ = 0;                                                 \
+            while (j__ < i__ &&                                          \
+                   (TOPO)->cpus[j__].MEMBER != (TOPO)->cpus[i__].MEMBER) \
+            {                                                            \
+                j__++;                                                   \
+            }                                                            \
+            (RESULT) += j__ == i__;                                      \
+        }                                                                \
+    } while (0)
+
+struct cpu_order_aux {
+    const struct cpu_topology *topo;
+    const int *core_rank;       /* Rank of each core within its node */
+    enum cpu_pin_policy policy;
+};
+
+static int
+cpu_order_compare(const void *a_, const void *b_, void *aux_)
+{
+    const struct cpu_order_aux *aux = aux_;
+    const struct cpu_info *a = &aux->topo->cpus[*(const int *)a_];
+    const struct cpu_info *b = &aux->topo->cpus[*(const int *)b_];
+    int keys_a[4], keys_b[4];
+
+    switch (aux->policy) {
+    case CPU_PIN_COMPACT:
+        keys_a[0] = a->node; keys_a[1] = a->package;
+        keys_a[2] = a->core; keys_a[3] = a->smt;
+        keys_b[0] = b->node; keys_b[1] = b->package;
+        keys_b[2] = b->core; keys_b[3] = b->smt;
+        break;
+    case CPU_PIN_CORES:
+        keys_a[0] = a->smt; keys_a[1] = a->node;
+        keys_a[2] = a->package; keys_a[3] = a->core;
+        keys_b[0] = b->smt; keys_b[1] = b->node;
+        keys_b[2] = b->package; keys_b[3] = b->core;
+        break;
+    case CPU_PIN_SCATTER:
+    default:
+        keys_a[0] = a->smt; keys_a[1] = aux->core_rank[a->core];
+        keys_a[2] = a->node; keys_a[3] = a->core;
+        keys_b[0] = b->smt; keys_b[1] = aux->core_rank[b->core];
+        keys_b[2] = b->node; keys_b[3] = b->core;
+        break;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        if (keys_a[i] != keys_b[i]) {
+            return keys_a[i] < keys_b[i] ? -1 : 1;
+        }
+    }
+    return a->cpu - b->cpu;
+}
+
+static void
+compute_orders(struct cpu_topology *topo)
+{
+    struct cpu_order_aux aux;
+    int *core_node = xmalloc(topo->num_cores * sizeof(*core_node));
+    int *core_rank = xmalloc(topo->num_cores * sizeof(*core_rank));
+
+    for (int i = 0; i < topo->num_cpus; i++) {
+        core_node[topo->cpus[i].core] = topo->cpus[i].node;
+    }
+    for (int c = 0; c < topo->num_cores; c++) {
+        core_rank[c] = 0;
+        for (int d = 0; d < c; d++) {
+            core_rank[c] += core_node[d] == core_node[c];
+        }
+    }
+
+    aux.topo = topo;
+    aux.core_rank = core_rank;
+    for (int p = 0; p < CPU_PIN_POLICIES; p++) {
+        topo->order[p] = xmalloc(topo->num_cpus * sizeof(int));
+        for (int i = 0; i < topo->num_cpus; i++) {
+            topo->order[p][i] = i;
+        }
+        aux.policy = p;
+        qsort_r(topo->order[p], topo->num_cpus, sizeof(int),
+                cpu_order_compare, &aux);
+    }
+
+    free(core_rank);
+    free(core_node);
+}
+
+struct cpu_topology *
+cpu_topology_create_from(const char *root)
+{
+    struct cpu_topology *topo = xmalloc(sizeof(*topo));
+
+    memset(topo, 0, sizeof(*topo));
+    read_online(topo, root);
+    read_cores(topo, root);
+    for (int i = 0; i < topo->num_cpus; i++) {
+        topo->cpus[i].node = read_cpu_node(root, topo->cpus[i].cpu);
+    }
+    read_node_lists(topo, root);
+    for (int i = 0; i < topo->num_cpus; i++) {
+        topo->cpus[i].node = MAX(topo->cpus[i].node, 0);
+    }
+    read_caches(topo, root);
+
+    COUNT_DISTINCT(topo, package, topo->num_packages);
+    COUNT_DISTINCT(topo, node, topo->num_nodes);
+    compute_orders(topo);
+    return topo;
+}
+
+struct cpu_topology *
+cpu_topology_create(void)
+{
+    return cpu_topology_create_from(CPU_TOPOLOGY_ROOT);
+}
+
+void
+cpu_topology_destroy(struct cpu_topology *topo)
+{
+    if (!topo) {
+        return;
+    }
+    for (int p = 0; p < CPU_PIN_POLICIES; p++) {
+        free(topo->order[p]);
+    }
+    free(topo->cpus);
+    free(topo);
+}
+
+const struct cpu_cache *
+cpu_topology_cache(const struct cpu_topology *topo, int level)
+{
+    for (int i = 0; i < topo->num_caches; i++) {
+        const struct cpu_cache *cache = &topo->caches[i];
+        if (cache->level == level && cache->type != CPU_CACHE_INSTRUCTION) {
+            return cache;
+        }
+    }
+    return NULL;
+}
+
+int
+cpu_topology_select(const struct cpu_topology *topo,
+                    enum cpu_pin_policy policy, int index)
+{
+    ASSERT(policy >= 0 && policy < CPU_PIN_POLICIES);
+    ASSERT(index >= 0);
+    return topo->cpus[topo->order[policy][index % topo->num_cpus]].cpu;
+}
+
+int
+cpu_pin_thread(pthread_t thread, int cpu)
+{
+    cpu_set_t set;
+    int error;
+
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        errno = EINVAL;
+        return -1;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    error = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+int
+cpu_topology_pin(const struct cpu_topology *topo, pthread_t thread,
+                 enum cpu_pin_policy policy, int index)
+{
+    int cpu = cpu_topology_select(topo, policy, index);
+    return cpu_pin_thread(thread, cpu) ? -1 : cpu;
+}
+
+void
+cpu_topology_print(const struct cpu_topology *topo, FILE *dst)
+{
+    static const char *type_names[] = { "", "d", "i", "" };
+
+    fprintf(dst, "%d CPUs, %d cores, %d packages, %d NUMA nodes\n",
+            topo->num_cpus, topo->num_cores, topo->num_packages,
+            topo->num_nodes);
+    for (int i = 0; i < topo->num_caches; i++) {
+        const struct cpu_cache *cache = &topo->caches[i];
+        fprintf(dst, "  L%d%s: %zu KB, %zu B lines, shared by %d CPUs\n",
+                cache->level, type_names[cache->type], cache->size >> 10,
+                cache->line_size, cache->shared);
+    }
+    for (int i = 0; i < topo->num_cpus; i++) {
+        const struct cpu_info *info = &topo->cpus[i];
+        fprintf(dst, "  cpu %-4d core %-4d package %-2d node %-2d smt %d\n",
+                info->cpu, info->core, info->package, info->node, info->smt);
+    }
+}
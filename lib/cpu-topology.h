@@ -0,0 +1,99 @@
+#ifndef _CPU_TOPOLOGY_H
+#define _CPU_TOPOLOGY_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* CPU topology as exposed by Linux in "/sys/devices/system/cpu": online
+ * CPUs, the physical cores and packages they belong to, their SMT siblings,
+ * NUMA nodes and caches. Missing sysfs entries are not an error: a CPU with
+ * unknown topology is treated as a core of its own on node 0, and cache
+ * sizes fall back to sysconf, or 0 when unknown. */
+
+#define CPU_TOPOLOGY_MAX_CACHES 8
+
+enum cpu_cache_type {
+    CPU_CACHE_UNKNOWN,
+    CPU_CACHE_DATA,
+    CPU_CACHE_INSTRUCTION,
+    CPU_CACHE_UNIFIED,
+};
+
+struct cpu_cache {
+    int level;                  /* 1 for L1, etc. */
+    enum cpu_cache_type type;
+    size_t size;                /* In bytes, 0 when unknown */
+    size_t line_size;           /* In bytes, 0 when unknown */
+    int shared;                 /* Number of CPUs sharing it, 0 if unknown */
+};
+
+struct cpu_info {
+    int cpu;                    /* Logical CPU number, as used by affinity */
+    int core;                   /* Physical core, 0 to "num_cores" - 1 */
+    int package;                /* "physical_package_id", 0 when unknown */
+    int node;                   /* NUMA node, 0 when unknown */
+    int smt;                    /* Index among the SMT siblings of "core" */
+};
+
+/* Orders in which threads are assigned to CPUs */
+enum cpu_pin_policy {
+    /* Fill SMT siblings, then cores, then packages and nodes, so threads
+     * share as many caches as possible */
+    CPU_PIN_COMPACT,
+    /* One thread per physical core before using any SMT sibling */
+    CPU_PIN_CORES,
+    /* One thread per physical core, alternating between NUMA nodes */
+    CPU_PIN_SCATTER,
+    CPU_PIN_POLICIES
+};
+
+struct cpu_topology {
+    int num_cpus;               /* Online CPUs */
+    int num_cores;              /* Physical cores */
+    int num_packages;
+    int num_nodes;
+    struct cpu_info *cpus;      /* Sorted by CPU number */
+    struct cpu_cache caches[CPU_TOPOLOGY_MAX_CACHES];  /* As seen by cpus[0] */
+    int num_caches;
+    int *order[CPU_PIN_POLICIES];  /* Indices into "cpus" per policy */
+};
+
+/* Reads the topology of the running system. Never fails: on a system
+ * without sysfs, returns the online CPUs as independent cores. */
+struct cpu_topology *cpu_topology_create(void);
+
+/* Same, but reads "root"/cpu and "root"/node instead of
+ * "/sys/devices/system". Useful for testing. */
+struct cpu_topology *cpu_topology_create_from(const char *root);
+
+void cpu_topology_destroy(struct cpu_topology *topo);
+
+/* Returns the data or unified cache at "level", or NULL if unknown */
+const struct cpu_cache *cpu_topology_cache(const struct cpu_topology *topo,
+                                           int level);
+
+/* Returns the CPU number for the "index"-th thread under "policy". Indices
+ * beyond the number of CPUs wrap around. */
+int cpu_topology_select(const struct cpu_topology *topo,
+                        enum cpu_pin_policy policy, int index);
+
+/* Pins "thread" to "cpu". Returns 0 on success, or -1 and sets errno. */
+int cpu_pin_thread(pthread_t thread, int cpu);
+
+/* Pins "thread" to the CPU selected for "index" under "policy". Returns the
+ * CPU number, or -1 and sets errno. */
+int cpu_topology_pin(const struct cpu_topology *topo, pthread_t thread,
+                     enum cpu_pin_policy policy, int index);
+
+void cpu_topology_print(const struct cpu_topology *topo, FILE *dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
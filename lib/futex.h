@@ -0,0 +1,46 @@
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Wait-on-address primitives over the Linux futex syscall. "addr" must
+ * point to an aligned 32-bit word. Only threads of the same process may
+ * wait and wake on the same word. */
+
+/* Wakes all threads waiting on a word */
+#define FUTEX_WAKE_ALL INT_MAX
+
+/* Blocks the calling thread while the 32-bit word at "addr" equals
+ * "expected", until "futex_wake" is called on "addr". Returns 0 on wakeup,
+ * or -1 and sets errno to EAGAIN if the word did not equal "expected", or
+ * EINTR on a signal. Callers must recheck their condition in either case, as
+ * wakeups may be spurious. */
+static inline int
+futex_wait(void *addr, uint32_t expected)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected,
+                   NULL, NULL, 0) ? -1 : 0;
+}
+
+/* Wakes at most "count" threads waiting on "addr". Returns the number of
+ * threads woken. */
+static inline int
+futex_wake(void *addr, int count)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count,
+                   NULL, NULL, 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
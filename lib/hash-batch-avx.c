@@ -0,0 +1,9 @@
+/* AVX kernels of the hash batch functions, see "hash-batch.h" */
+
+#include "hash.h"
+
+#ifdef HASH_BATCH_KERNELS
+#pragma GCC target("avx")
+#define HASH_BATCH_ISA avx
+#include "hash-batch.h"
+#endif
@@ -0,0 +1,9 @@
+/* AVX2 kernels of the hash batch functions, see "hash-batch.h" */
+
+#include "hash.h"
+
+#ifdef HASH_BATCH_KERNELS
+#pragma GCC target("avx2")
+#define HASH_BATCH_ISA avx2
+#include "hash-batch.h"
+#endif
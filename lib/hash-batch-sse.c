@@ -0,0 +1,9 @@
+/* Kernels of the hash batch functions for the baseline ISA of the build,
+ * see "hash-batch.h" */
+
+#include "hash.h"
+
+#ifdef HASH_BATCH_KERNELS
+#define HASH_BATCH_ISA sse
+#include "hash-batch.h"
+#endif
@@ -0,0 +1,129 @@
+/* SIMD kernels of "hash_int_batch" and "hash_uint64_batch" for the
+ * Murmur-based "hash_add". Each lib/hash-batch-<isa>.c includes this once,
+ * after selecting its instruction set with "#pragma GCC target" and
+ * defining HASH_BATCH_ISA, so that "simd.h" picks the matching vector
+ * width. "hash.h" must be included before the pragma, so that the hash
+ * functions stay the ones of the build. Without HASH_BATCH_ISA, only
+ * declares the kernels. No include guard on purpose. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_BATCH_DECLARE(ISA)                                           \
+    void hash_int_batch_##ISA(const uint32_t *in, uint32_t *out,          \
+                              size_t n, uint32_t basis);                  \
+    void hash_uint64_batch_##ISA(const uint64_t *in, uint32_t *out,       \
+                                 size_t n, uint32_t basis);
+
+HASH_BATCH_DECLARE(sse)
+HASH_BATCH_DECLARE(avx)
+HASH_BATCH_DECLARE(avx2)
+
+#ifdef HASH_BATCH_ISA
+#include "simd.h"
+
+#define HASH_BATCH_FUNC__(NAME, ISA) NAME##_##ISA
+#define HASH_BATCH_FUNC_(NAME, ISA) HASH_BATCH_FUNC__(NAME, ISA)
+#define HASH_BATCH_FUNC(NAME) HASH_BATCH_FUNC_(NAME, HASH_BATCH_ISA)
+
+static inline EPU_REG
+hash_rot_simd(EPU_REG x, int k)
+{
+    EPU_REG left, right;
+    SIMD_SLL_EPI32(left, x, k);
+    SIMD_SRL_EPI32(right, x, 32 - k);
+    return SIMD_OR_SI(left, right);
+}
+
+/* The part of "mhash_add" that follows mixing in the data. Multiplies by 5
+ * with a shift, as SSE2 has no 32-bit multiply. */
+static inline EPU_REG
+mhash_mix_simd(EPU_REG hash)
+{
+    EPU_REG tmp;
+
+    hash = hash_rot_simd(hash, 13);
+    SIMD_SLL_EPI32(tmp, hash, 2);
+    return SIMD_ADD_EPI32(SIMD_ADD_EPI32(hash, tmp),
+                          SIMD_SET1_EPI32(0xe6546b64));
+}
+
+/* Same as "mhash_add", including for zero data, which the scalar version
+ * skips only as a shortcut */
+static inline EPU_REG
+mhash_add_simd(EPU_REG hash, EPU_REG data)
+{
+    data = SIMD_MULLO_EPI32(data, SIMD_SET1_EPI32(0xcc9e2d51));
+    data = hash_rot_simd(data, 15);
+    data = SIMD_MULLO_EPI32(data, SIMD_SET1_EPI32(0x1b873593));
+    return mhash_mix_simd(SIMD_XOR_SI(hash, data));
+}
+
+/* Same as "hash_finish" */
+static inline EPU_REG
+hash_finish_simd(EPU_REG hash, uint32_t final)
+{
+    EPU_REG tmp;
+
+    hash = SIMD_XOR_SI(hash, SIMD_SET1_EPI32(final));
+    SIMD_SRL_EPI32(tmp, hash, 16);
+    hash = SIMD_MULLO_EPI32(SIMD_XOR_SI(hash, tmp),
+                            SIMD_SET1_EPI32(0x85ebca6b));
+    SIMD_SRL_EPI32(tmp, hash, 13);
+    hash = SIMD_MULLO_EPI32(SIMD_XOR_SI(hash, tmp),
+                            SIMD_SET1_EPI32(0xc2b2ae35));
+    SIMD_SRL_EPI32(tmp, hash, 16);
+    return SIMD_XOR_SI(hash, tmp);
+}
+
+void
+HASH_BATCH_FUNC(hash_int_batch)(const uint32_t *in, uint32_t *out, size_t n,
+                                uint32_t basis)
+{
+    /* hash_finish(hash_add(hash_add(x, 0), basis), 8). Adding zero only
+     * mixes, and the data part of adding "basis" is the same for all keys. */
+    EPU_REG basis_ = SIMD_SET1_EPI32(mhash_add__(0, basis));
+    size_t i = 0;
+
+    for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+        EPU_REG hash = SIMD_LOADU_SI(&in[i]);
+        hash = mhash_mix_simd(hash);
+        hash = mhash_mix_simd(SIMD_XOR_SI(hash, basis_));
+        hash = hash_finish_simd(hash, 8);
+        SIMD_STOREU_SI(&out[i], hash);
+    }
+    for (; i < n; i++) {
+        out[i] = hash_int(in[i], basis);
+    }
+}
+
+void
+HASH_BATCH_FUNC(hash_uint64_batch)(const uint64_t *in, uint32_t *out,
+                                   size_t n, uint32_t basis)
+{
+    size_t i = 0;
+
+    /* Needs six multiplies per key, which is slower than the scalar loop
+     * when SSE2 has to emulate them */
+#ifdef __SSE4_1__
+    /* hash_finish(hash_add(hash_add(basis, lo), hi), 8) */
+    EPU_REG basis_ = SIMD_SET1_EPI32(basis);
+    simd_vector_t lo, hi;
+
+    for (; i + SIMD_WIDTH <= n; i += SIMD_WIDTH) {
+        EPU_REG hash;
+        for (int j = 0; j < SIMD_WIDTH; j++) {
+            lo.integers[j] = in[i + j];
+            hi.integers[j] = in[i + j] >> 32;
+        }
+        hash = mhash_add_simd(basis_, SIMD_LOADU_SI(lo.integers));
+        hash = mhash_add_simd(hash, SIMD_LOADU_SI(hi.integers));
+        hash = hash_finish_simd(hash, 8);
+        SIMD_STOREU_SI(&out[i], hash);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = hash_uint64_basis(in[i], basis);
+    }
+}
+#endif
@@ -16,6 +16,11 @@
 
 #include "hash.h"
 #include <string.h>
+#include <stdatomic.h>
+#include <sys/random.h>
+#include "random.h"
+#include "cpu-features.h"
+#include "hash-batch.h"
 
 /* Returns the hash of 'a', 'b', and 'c'. */
 uint32_t
@@ -26,17 +31,20 @@ hash_3words(uint32_t a, uint32_t b, uint32_t c)
 
 /* Returns the hash of the 'n' bytes at 'p', starting from 'basis'. */
 uint32_t
-hash_bytes(const void *p_, size_t n, uint32_t basis)
+hash_bytes_generic(const void *p_, size_t n, uint32_t basis)
 {
-    const uint32_t *p = p_;
+    const uint8_t *p = p_;
     size_t orig_n = n;
     uint32_t hash;
 
     hash = basis;
     while (n >= 4) {
-        hash = hash_add(hash, (uint32_t)*(char*)p);
+        uint32_t word;
+
+        memcpy(&word, p, sizeof word);
+        hash = hash_add(hash, word);
         n -= 4;
-        p += 1;
+        p += 4;
     }
 
     if (n) {
@@ -49,6 +57,98 @@ hash_bytes(const void *p_, size_t n, uint32_t basis)
     return hash_finish(hash, orig_n);
 }
 
+#ifdef HASH_HAVE_CRC32C
+/* A crc32 instruction has a latency of 3 cycles but a throughput of one per
+ * cycle, so three independent streams keep the unit busy. The length is only
+ * mixed in at the end, so "struct hasher" can produce the same result without
+ * knowing it in advance. */
+__attribute__((target("sse4.2")))
+uint32_t
+hash_bytes_crc32c(const void *p_, size_t n, uint32_t basis)
+{
+    const uint8_t *p = p_;
+    size_t orig_n = n;
+    uint64_t hash1 = basis;
+    uint64_t hash2 = 0;
+    uint64_t hash3 = 0;
+
+    while (n >= 24) {
+        hash1 = _mm_crc32_u64(hash1, hash_load64__(p));
+        hash2 = _mm_crc32_u64(hash2, hash_load64__(p + 8));
+        hash3 = _mm_crc32_u64(hash3, hash_load64__(p + 16));
+        n -= 24;
+        p += 24;
+    }
+    if (n >= 8) {
+        hash1 = _mm_crc32_u64(hash1, hash_load64__(p));
+        n -= 8;
+        p += 8;
+    }
+    if (n >= 8) {
+        hash2 = _mm_crc32_u64(hash2, hash_load64__(p));
+        n -= 8;
+        p += 8;
+    }
+    if (n) {
+        hash3 = _mm_crc32_u64(hash3, hash_load_tail__(p, n));
+    }
+    return hash_crc32c_finish__(hash1, hash2, hash3, orig_n);
+}
+#endif
+
+typedef uint32_t hash_bytes_func(const void *, size_t, uint32_t);
+
+static uint32_t hash_bytes_resolve(const void *, size_t, uint32_t);
+static _Atomic(hash_bytes_func *) hash_bytes_impl = hash_bytes_resolve;
+
+/* "hasher_init" makes the same choice */
+static hash_bytes_func *
+hash_bytes_select(void)
+{
+#ifdef HASH_HAVE_CRC32C
+    if (cpu_has(CPU_FEATURE_SSE4_2)) {
+        return hash_bytes_crc32c;
+    }
+#endif
+    return hash_bytes_generic;
+}
+
+/* Every thread that races here stores the same pointer */
+static uint32_t
+hash_bytes_resolve(const void *p, size_t n, uint32_t basis)
+{
+    hash_bytes_func *func = hash_bytes_select();
+    atomic_store_explicit(&hash_bytes_impl, func, memory_order_relaxed);
+    return func(p, n, basis);
+}
+
+uint32_t
+hash_bytes(const void *p, size_t n, uint32_t basis)
+{
+    hash_bytes_func *func;
+    func = atomic_load_explicit(&hash_bytes_impl, memory_order_relaxed);
+    return func(p, n, basis);
+}
+
+#ifdef HASH_HAVE_CRC32C
+bool
+hash_bytes_crc32c_used(void)
+{
+    return hash_bytes_select() == hash_bytes_crc32c;
+}
+#endif
+
+const char *
+hash_bytes_impl_name(void)
+{
+#ifdef HASH_HAVE_CRC32C
+    if (hash_bytes_select() == hash_bytes_crc32c) {
+        return "crc32c";
+    }
+#endif
+    return "generic";
+}
+
 uint32_t
 hash_double(double x, uint32_t basis)
 {
@@ -57,6 +157,212 @@ hash_double(double x, uint32_t basis)
     return hash_3words(value[0], value[1], basis);
 }
 
+static void
+hash_int_batch_scalar(const uint32_t *in, uint32_t *out, size_t n,
+                      uint32_t basis)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = hash_int(in[i], basis);
+    }
+}
+
+static void
+hash_uint64_batch_scalar(const uint64_t *in, uint32_t *out, size_t n,
+                         uint32_t basis)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = hash_uint64_basis(in[i], basis);
+    }
+}
+
+/* Kernels of the batch functions, best first. The first one whose
+ * "features" the CPU has is used. */
+struct hash_batch_impl {
+    const char *name;
+    uint32_t features;
+    void (*int_batch)(const uint32_t *, uint32_t *, size_t, uint32_t);
+    void (*uint64_batch)(const uint64_t *, uint32_t *, size_t, uint32_t);
+};
+
+static const struct hash_batch_impl hash_batch_impls[] = {
+#ifdef HASH_BATCH_KERNELS
+    { "avx2", CPU_FEATURE_AVX2, hash_int_batch_avx2,
+      hash_uint64_batch_avx2 },
+    { "avx", CPU_FEATURE_AVX, hash_int_batch_avx, hash_uint64_batch_avx },
+    { "sse", 0, hash_int_batch_sse, hash_uint64_batch_sse },
+#endif
+    { "scalar", 0, hash_int_batch_scalar, hash_uint64_batch_scalar },
+};
+
+static _Atomic(const struct hash_batch_impl *) hash_batch_impl;
+
+/* Every thread that races here stores the same pointer */
+static const struct hash_batch_impl *
+hash_batch_get(void)
+{
+    const struct hash_batch_impl *impl;
+
+    impl = atomic_load_explicit(&hash_batch_impl, memory_order_relaxed);
+    if (!impl) {
+        impl = hash_batch_impls;
+        while (!cpu_has(impl->features)) {
+            impl++;
+        }
+        atomic_store_explicit(&hash_batch_impl, impl, memory_order_relaxed);
+    }
+    return impl;
+}
+
+void
+hash_int_batch(const uint32_t *in, uint32_t *out, size_t n, uint32_t basis)
+{
+    hash_batch_get()->int_batch(in, out, n, basis);
+}
+
+void
+hash_uint64_batch(const uint64_t *in, uint32_t *out, size_t n,
+                  uint32_t basis)
+{
+    hash_batch_get()->uint64_batch(in, out, n, basis);
+}
+
+const char *
+hash_batch_impl_name(void)
+{
+    return hash_batch_get()->name;
+}
+
+/* Returns the 64-bit hash of the 'n' bytes at 'p', starting from 'basis'.
+ * Processes 48 bytes per step in three independent streams. */
+uint64_t
+hash64_bytes(const void *p_, size_t n, uint64_t basis)
+{
+    const uint8_t *p = p_;
+    uint64_t seed = basis ^ hash64_mix__(basis ^ HASH64_P0, HASH64_P1);
+    uint64_t a, b;
+
+    if (n <= 16) {
+        if (n >= 4) {
+            size_t mid = (n >> 3) << 2;
+            a = (uint64_t)hash_load32__(p) << 32 | hash_load32__(p + mid);
+            b = (uint64_t)hash_load32__(p + n - 4) << 32 |
+                hash_load32__(p + n - 4 - mid);
+        } else if (n > 0) {
+            a = (uint64_t)p[0] << 16 | (uint64_t)p[n >> 1] << 8 | p[n - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = n;
+        if (i > 48) {
+            uint64_t seed1 = seed, seed2 = seed;
+            do {
+                seed = hash64_mix__(hash_load64__(p) ^ HASH64_P1,
+                                    hash_load64__(p + 8) ^ seed);
+                seed1 = hash64_mix__(hash_load64__(p + 16) ^ HASH64_P2,
+                                     hash_load64__(p + 24) ^ seed1);
+                seed2 = hash64_mix__(hash_load64__(p + 32) ^ HASH64_P3,
+                                     hash_load64__(p + 40) ^ seed2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (i > 16) {
+            seed = hash64_mix__(hash_load64__(p) ^ HASH64_P1,
+                                hash_load64__(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = hash_load64__(p + i - 16);
+        b = hash_load64__(p + i - 8);
+    }
+
+    a ^= HASH64_P1;
+    b ^= seed;
+    hash64_mum__(&a, &b);
+    return hash64_mix__(a ^ HASH64_P0 ^ n, b ^ HASH64_P1);
+}
+
+void
+hash_key_init_random(struct hash_key *key)
+{
+    if (getrandom(key, sizeof *key, 0) != sizeof *key) {
+        random_bytes(key, sizeof *key);
+    }
+}
+
+static inline uint64_t
+hash_rotl64__(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline void
+hash_sipround__(uint64_t v[4])
+{
+    v[0] += v[1];
+    v[1] = hash_rotl64__(v[1], 13);
+    v[1] ^= v[0];
+    v[0] = hash_rotl64__(v[0], 32);
+    v[2] += v[3];
+    v[3] = hash_rotl64__(v[3], 16);
+    v[3] ^= v[2];
+    v[0] += v[3];
+    v[3] = hash_rotl64__(v[3], 21);
+    v[3] ^= v[0];
+    v[2] += v[1];
+    v[1] = hash_rotl64__(v[1], 17);
+    v[1] ^= v[2];
+    v[2] = hash_rotl64__(v[2], 32);
+}
+
+/* SipHash-c-d; message words are read in little-endian order */
+static inline uint64_t
+hash_siphash__(const void *p_, size_t n, const struct hash_key *key,
+               int c_rounds, int d_rounds)
+{
+    const uint8_t *p = p_;
+    uint64_t v[4] = {
+        0x736f6d6570736575ULL ^ key->k0,
+        0x646f72616e646f6dULL ^ key->k1,
+        0x6c7967656e657261ULL ^ key->k0,
+        0x7465646279746573ULL ^ key->k1,
+    };
+    uint64_t last = (uint64_t)n << 56;
+
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t m = hash_load64__(p);
+        v[3] ^= m;
+        for (int i = 0; i < c_rounds; i++) {
+            hash_sipround__(v);
+        }
+        v[0] ^= m;
+    }
+    for (size_t i = 0; i < n; i++) {
+        last |= (uint64_t)p[i] << (8 * i);
+    }
+
+    v[3] ^= last;
+    for (int i = 0; i < c_rounds; i++) {
+        hash_sipround__(v);
+    }
+    v[0] ^= last;
+    v[2] ^= 0xff;
+    for (int i = 0; i < d_rounds; i++) {
+        hash_sipround__(v);
+    }
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+/* Returns the SipHash-1-3 of the 'n' bytes at 'p' under 'key'. */
+uint64_t
+hash_siphash(const void *p, size_t n, const struct hash_key *key)
+{
+    return hash_siphash__(p, n, key, 1, 3);
+}
+
 uint32_t
 hash_words__(const uint32_t p[], size_t n_words, uint32_t basis)
 {
@@ -36,8 +36,79 @@ hash_rot(uint32_t x, int k)
     return (x << k) | (x >> (32 - k));
 }
 
+/* Uses the fastest implementation the running CPU supports. The result
+ * depends on the implementation, so hash values must not be stored or sent
+ * to other hosts. */
 uint32_t hash_bytes(const void *, size_t n_bytes, uint32_t basis);
 
+/* Portable implementation of "hash_bytes", based on "hash_add" */
+uint32_t hash_bytes_generic(const void *, size_t n_bytes, uint32_t basis);
+
+static inline uint64_t
+hash_load64__(const uint8_t *p)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof word);
+    return word;
+}
+
+static inline uint32_t
+hash_load32__(const uint8_t *p)
+{
+    uint32_t word;
+    memcpy(&word, p, sizeof word);
+    return word;
+}
+
+/* Loads the last 1 to 7 bytes of a key without a variable-length memcpy.
+ * Bytes may be read twice, which is fine since the length is hashed too. */
+static inline uint64_t
+hash_load_tail__(const uint8_t *p, size_t n)
+{
+    if (n >= 4) {
+        return hash_load32__(p) | (uint64_t)hash_load32__(p + n - 4) << 32;
+    }
+    return (uint32_t)p[0] << 16 | (uint32_t)p[n >> 1] << 8 | p[n - 1];
+}
+
+/* Final mix of the crc32 based hashes. A crc is linear in its input, so a
+ * flipped input bit flips a fixed set of crc bits; a single multiply only
+ * carries those upwards, which left some output bits nearly unaffected by
+ * some input bits. Two 64-bit multiplies with a fold in between make every
+ * output bit depend on every crc bit. */
+static inline uint32_t
+hash_crc_mix__(uint64_t crc)
+{
+    uint64_t x = crc * 0x9e3779b97f4a7c15ULL;
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ULL;
+    return x >> 32;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define HASH_HAVE_CRC32C 1
+/* Hashes 24 bytes per step with three independent crc32 streams. Requires
+ * SSE4.2 at runtime regardless of the build flags. */
+uint32_t hash_bytes_crc32c(const void *, size_t n_bytes, uint32_t basis);
+
+/* True if "hash_bytes" uses "hash_bytes_crc32c", i.e., the CPU has SSE4.2 */
+bool hash_bytes_crc32c_used(void);
+
+/* Combines the streams of "hash_bytes_crc32c" with the length */
+__attribute__((target("sse4.2")))
+static inline uint32_t
+hash_crc32c_finish__(uint64_t hash1, uint64_t hash2, uint64_t hash3,
+                     uint64_t n)
+{
+    uint64_t hash = _mm_crc32_u64(hash1, hash2 << 32 | hash3);
+    return hash_crc_mix__(_mm_crc32_u64(hash, n));
+}
+#endif
+
+/* Name of the implementation "hash_bytes" uses */
+const char *hash_bytes_impl_name(void);
+
 static inline uint32_t hash_int(uint32_t x, uint32_t basis);
 static inline uint32_t hash_2words(uint32_t, uint32_t);
 static inline uint32_t hash_uint64(const uint64_t);
@@ -45,6 +116,18 @@ static inline uint32_t hash_uint64_basis(const uint64_t x,
                                          const uint32_t basis);
 uint32_t hash_3words(uint32_t, uint32_t, uint32_t);
 
+/* Set "out[i]" to "hash_int(in[i], basis)" and to
+ * "hash_uint64_basis(in[i], basis)", respectively, for "n" keys. Uses SIMD
+ * where the build's "hash_add" allows it, with the widest kernel the
+ * running CPU supports. */
+void hash_int_batch(const uint32_t *in, uint32_t *out, size_t n,
+                    uint32_t basis);
+void hash_uint64_batch(const uint64_t *in, uint32_t *out, size_t n,
+                       uint32_t basis);
+
+/* Name of the kernel the batch functions use, e.g., "avx2" */
+const char *hash_batch_impl_name(void);
+
 static inline uint32_t hash_boolean(bool x, uint32_t basis);
 uint32_t hash_double(double, uint32_t basis);
 
@@ -103,6 +186,12 @@ static inline uint32_t hash_add_bytes64(uint32_t, const uint64_t *, size_t);
 #include "hash-aarch64.h"
 
 #elif !(defined(__SSE4_2__) && defined(__x86_64__))
+/* The Murmur-based "hash_add" vectorizes with identical results, so the
+ * batch functions have kernels for several x86 ISAs, see "hash-batch.h" */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(NSIMD)
+#define HASH_BATCH_KERNELS 1
+#endif
+
 /* Mhash-based implementation. */
 
 static inline uint32_t hash_add(uint32_t hash, uint32_t data)
@@ -182,10 +271,7 @@ static inline uint32_t hash_add64(uint32_t hash, uint64_t data)
 
 static inline uint32_t hash_finish(uint64_t hash, uint64_t final)
 {
-    /* The finishing multiplier 0x805204f3 has been experimentally
-     * derived to pass the testsuite hash tests. */
-    hash = _mm_crc32_u64(hash, final) * 0x805204f3;
-    return hash ^ (uint32_t)hash >> 16; /* Increase entropy in LSBs. */
+    return hash_crc_mix__(_mm_crc32_u64(hash, final));
 }
 
 /* Returns the hash of the 'n' 32-bit words at 'p_', starting from 'basis'.
@@ -398,6 +484,279 @@ hash_uuid(struct uuid *uuid)
     return hash_bytes(uuid, 4, 0);
 }
 
+/* Incremental hashing of keys made of several fields, without copying them
+ * into a temporary buffer. The result equals "hash_bytes" of all updates
+ * concatenated: like "hash_bytes", the hasher uses crc32c whenever the CPU
+ * has SSE4.2, even if the build does not, and the generic hash otherwise.
+ * Usage:
+ *
+ * struct hasher hasher;
+ * hasher_init(&hasher, basis);
+ * hasher_update_u32(&hasher, key->ip);
+ * hasher_update_bytes(&hasher, key->name, key->name_len);
+ * hash = hasher_finish(&hasher);
+ */
+#if defined(__SSE4_2__) && defined(__x86_64__)
+#define HASHER_CRC32C_ALWAYS 1
+#endif
+
+/* Bytes per update of the crc32c streams. The generic hash adds them as
+ * two 32-bit words. */
+#define HASHER_WORD 8
+
+struct hasher {
+    uint64_t streams[3];            /* "streams[0]" only, if generic */
+    size_t n;                       /* Bytes so far */
+    uint8_t word[HASHER_WORD];      /* Pending bytes of a partial word */
+#if defined(HASH_HAVE_CRC32C) && !defined(HASHER_CRC32C_ALWAYS)
+    bool crc32c;
+#endif
+};
+
+static inline bool
+hasher_crc32c__(const struct hasher *hasher)
+{
+#if defined(HASHER_CRC32C_ALWAYS)
+    (void) hasher;
+    return true;
+#elif defined(HASH_HAVE_CRC32C)
+    return hasher->crc32c;
+#else
+    (void) hasher;
+    return false;
+#endif
+}
+
+static inline void
+hasher_init(struct hasher *hasher, uint32_t basis)
+{
+    hasher->streams[0] = basis;
+    hasher->streams[1] = 0;
+    hasher->streams[2] = 0;
+    hasher->n = 0;
+#if defined(HASH_HAVE_CRC32C) && !defined(HASHER_CRC32C_ALWAYS)
+    /* Same choice as "hash_bytes" */
+    hasher->crc32c = hash_bytes_crc32c_used();
+#endif
+}
+
+#ifdef HASH_HAVE_CRC32C
+/* Not inlined into builds without SSE4.2 */
+__attribute__((target("sse4.2")))
+static inline void
+hasher_crc32c_add__(struct hasher *hasher, const uint8_t *p)
+{
+    size_t stream = (hasher->n / 8) % 3;
+    hasher->streams[stream] = _mm_crc32_u64(hasher->streams[stream],
+                                            hash_load64__(p));
+}
+
+__attribute__((target("sse4.2")))
+static inline uint32_t
+hasher_crc32c_finish__(const struct hasher *hasher)
+{
+    size_t tail = hasher->n % HASHER_WORD;
+    uint64_t last = hasher->streams[2];
+
+    if (tail) {
+        last = _mm_crc32_u64(last, hash_load_tail__(hasher->word, tail));
+    }
+    return hash_crc32c_finish__(hasher->streams[0], hasher->streams[1], last,
+                                hasher->n);
+}
+#endif
+
+/* Adds the word at "p" that starts at or before offset "hasher->n" */
+static inline void
+hasher_add_word__(struct hasher *hasher, const uint8_t *p)
+{
+#ifdef HASH_HAVE_CRC32C
+    if (hasher_crc32c__(hasher)) {
+        hasher_crc32c_add__(hasher, p);
+        return;
+    }
+#endif
+    hasher->streams[0] = hash_add(hash_add(hasher->streams[0],
+                                           hash_load32__(p)),
+                                  hash_load32__(p + 4));
+}
+
+static inline void
+hasher_update_bytes(struct hasher *hasher, const void *p_, size_t n)
+{
+    const uint8_t *p = (const uint8_t *) p_;
+    size_t fill = hasher->n % HASHER_WORD;
+
+    if (fill) {
+        size_t count = MIN(HASHER_WORD - fill, n);
+        memcpy(&hasher->word[fill], p, count);
+        if (fill + count == HASHER_WORD) {
+            hasher_add_word__(hasher, hasher->word);
+        }
+        hasher->n += count;
+        p += count;
+        n -= count;
+    }
+    while (n >= HASHER_WORD) {
+        hasher_add_word__(hasher, p);
+        hasher->n += HASHER_WORD;
+        p += HASHER_WORD;
+        n -= HASHER_WORD;
+    }
+    if (n) {
+        memcpy(hasher->word, p, n);
+        hasher->n += n;
+    }
+}
+
+static inline void
+hasher_update_u32(struct hasher *hasher, uint32_t x)
+{
+    hasher_update_bytes(hasher, &x, sizeof x);
+}
+
+static inline void
+hasher_update_u64(struct hasher *hasher, uint64_t x)
+{
+    hasher_update_bytes(hasher, &x, sizeof x);
+}
+
+static inline uint32_t
+hasher_finish(const struct hasher *hasher)
+{
+    size_t tail = hasher->n % HASHER_WORD;
+    const uint8_t *p = hasher->word;
+    uint32_t hash;
+
+#ifdef HASH_HAVE_CRC32C
+    if (hasher_crc32c__(hasher)) {
+        return hasher_crc32c_finish__(hasher);
+    }
+#endif
+    /* Same as the tail of "hash_bytes_generic" */
+    hash = hasher->streams[0];
+    if (tail >= 4) {
+        hash = hash_add(hash, hash_load32__(p));
+        p += 4;
+        tail -= 4;
+    }
+    if (tail) {
+        uint32_t tmp = 0;
+        memcpy(&tmp, p, tail);
+        hash = hash_add(hash, tmp);
+    }
+    return hash_finish(hash, hasher->n);
+}
+
+/* 64-bit hashes, for tables large enough that 32-bit hashes collide often,
+ * or that use the bits above the bucket index as tags. Based on wyhash by
+ * Wang Yi, from https://github.com/wangyi-fudan/wyhash, which is released
+ * into the public domain (The Unlicense).
+ *
+ * Unlike the 32-bit functions above, results do not depend on the build
+ * flags. */
+
+#define HASH64_P0 0xa0761d6478bd642fULL
+#define HASH64_P1 0xe7037ed1a0b428dbULL
+#define HASH64_P2 0x8ebc6af09c88c6e3ULL
+#define HASH64_P3 0x589965cc75374cc3ULL
+
+/* Sets "*a" and "*b" to the low and high halves of "*a" * "*b" */
+static inline void
+hash64_mum__(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 r = (unsigned __int128)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t lo = t + (rm1 << 32);
+    uint64_t carry = (t < rl) + (lo < t);
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+#endif
+}
+
+static inline uint64_t
+hash64_mix__(uint64_t a, uint64_t b)
+{
+    hash64_mum__(&a, &b);
+    return a ^ b;
+}
+
+uint64_t hash64_bytes(const void *, size_t n_bytes, uint64_t basis);
+
+static inline uint64_t
+hash64_uint64(uint64_t x, uint64_t basis)
+{
+    return hash64_mix__(hash64_mix__(x ^ HASH64_P0, basis ^ HASH64_P1) ^
+                        HASH64_P0, HASH64_P3);
+}
+
+static inline uint64_t
+hash64_int(uint32_t x, uint64_t basis)
+{
+    return hash64_uint64(x, basis);
+}
+
+static inline uint64_t
+hash64_2words(uint64_t x, uint64_t y)
+{
+    return hash64_uint64(x, hash64_uint64(y, 0));
+}
+
+static inline uint64_t
+hash64_pointer(const void *p, uint64_t basis)
+{
+    return hash64_uint64((uint64_t) (uintptr_t) p, basis);
+}
+
+static inline uint64_t
+hash64_words(const uint32_t p[], size_t n_words, uint64_t basis)
+{
+    return hash64_bytes(p, n_words * 4, basis);
+}
+
+static inline uint64_t
+hash64_string(const char *s, uint64_t basis)
+{
+    return hash64_bytes(s, strlen(s), basis);
+}
+
+/* Keyed hashing with SipHash-1-3 by Jean-Philippe Aumasson and Daniel J.
+ * Bernstein, see https://github.com/veorq/SipHash (public domain, CC0).
+ * Use it for keys that an attacker controls, e.g., from network traffic:
+ * without the secret key, colliding keys cannot be crafted, so chains stay
+ * short. Several times slower than "hash_bytes" on short keys. */
+struct hash_key {
+    uint64_t k0;
+    uint64_t k1;
+};
+
+/* Draws a secret from the kernel's random source, or from "random_bytes"
+ * if it is unavailable */
+void hash_key_init_random(struct hash_key *);
+
+uint64_t hash_siphash(const void *, size_t n_bytes, const struct hash_key *);
+
+static inline uint64_t
+hash_siphash_uint64(uint64_t x, const struct hash_key *key)
+{
+    return hash_siphash(&x, sizeof x, key);
+}
+
+/* Hash values stored by "map" and "cmap". Build the whole library with
+ * -DMAP_HASH64 to store 64-bit hashes, e.g., from the "hash64" functions. */
+#ifdef MAP_HASH64
+typedef uint64_t map_hash_t;
+#else
+typedef uint32_t map_hash_t;
+#endif
+
 #ifdef __cplusplus
 }
 #endif
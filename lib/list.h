@@ -63,6 +63,14 @@ static inline bool list_is_empty(const struct list *);
 static inline bool list_is_singleton(const struct list *);
 static inline bool list_is_short(const struct list *);
 
+/* Sorting. The comparator returns a negative, zero or positive value if
+ * the first element is less than, equal to or greater than the second. */
+typedef int list_compare_func(const struct list *, const struct list *,
+                              void *aux);
+static inline void list_sort(struct list *, list_compare_func *, void *aux);
+static inline void list_merge(struct list *dst, struct list *src,
+                              list_compare_func *, void *aux);
+
 
 /*Iterate through the list. From 2nd element (First is dummy)*/
 #define LIST_FOR_EACH(ITER, MEMBER, LIST)                               \
@@ -287,4 +295,102 @@ list_splice(struct list *before, struct list *first, struct list *last)
     before->prev = last;
 }
 
+/* Merges two NULL terminated chains linked by 'next'. On ties, elements of
+ * 'a' come first. */
+static inline struct list *
+list_merge_chains__(struct list *a, struct list *b, list_compare_func *cmp,
+                    void *aux)
+{
+    struct list *head = NULL;
+    struct list **tail = &head;
+
+    while (a && b) {
+        if (cmp(b, a, aux) < 0) {
+            *tail = b;
+            b = b->next;
+        } else {
+            *tail = a;
+            a = a->next;
+        }
+        tail = &(*tail)->next;
+    }
+    *tail = a ? a : b;
+    return head;
+}
+
+/* Sorts 'list' in place using 'cmp'. The sort is a stable bottom-up merge
+   sort that runs in O(n log n) and does not allocate. */
+static inline void
+list_sort(struct list *list, list_compare_func *cmp, void *aux)
+{
+    /* pending[i] is a sorted run of 2^i elements, or NULL */
+    struct list *pending[64] = { NULL };
+    struct list *elem, *next, *run, *prev;
+    int levels = 0;
+    int i;
+
+    if (list_is_short(list)) {
+        return;
+    }
+
+    /* Break the ring, then sort using 'next' pointers only */
+    list->prev->next = NULL;
+    for (elem = list->next; elem; elem = next) {
+        next = elem->next;
+        elem->next = NULL;
+        run = elem;
+        for (i = 0; pending[i]; i++) {
+            run = list_merge_chains__(pending[i], run, cmp, aux);
+            pending[i] = NULL;
+        }
+        pending[i] = run;
+        levels = MAX(levels, i + 1);
+    }
+
+    run = NULL;
+    for (i = 0; i < levels; i++) {
+        if (pending[i]) {
+            run = run ? list_merge_chains__(pending[i], run, cmp, aux)
+                      : pending[i];
+        }
+    }
+
+    /* Restore 'prev' pointers and close the ring */
+    prev = list;
+    for (elem = run; elem; elem = elem->next) {
+        elem->prev = prev;
+        prev->next = elem;
+        prev = elem;
+    }
+    prev->next = list;
+    list->prev = prev;
+}
+
+/* Merges the elements of 'src' into 'dst', where both are sorted by 'cmp'.
+   Consecutive elements of 'src' are spliced into 'dst' at once. On ties,
+   elements of 'dst' come first. Afterward, 'src' is empty. */
+static inline void
+list_merge(struct list *dst, struct list *src, list_compare_func *cmp,
+           void *aux)
+{
+    struct list *pos = dst->next;
+    struct list *first, *last;
+
+    while (!list_is_empty(src)) {
+        first = src->next;
+        while (pos != dst && cmp(first, pos, aux) >= 0) {
+            pos = pos->next;
+        }
+        if (pos == dst) {
+            list_splice(dst, first, src);
+            return;
+        }
+        last = first->next;
+        while (last != src && cmp(last, pos, aux) < 0) {
+            last = last->next;
+        }
+        list_splice(pos, first, last);
+    }
+}
+
 #endif
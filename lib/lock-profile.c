@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "util.h"
+#include "lock-profile.h"
+
+/* Lock sites are kept in a lock-free open-addressing table keyed by the
+ * address of their "where" string, so recording never takes a lock. Sites
+ * beyond the table capacity are merged into a single overflow entry. */
+#define LOCK_PROFILE_SITES 1024
+
+struct lock_profile_site {
+    _Atomic(const char *) where;
+    atomic_ulong acquisitions;
+    atomic_ulong contended;
+    atomic_ulong wait_ns;
+    atomic_ulong max_wait_ns;
+    atomic_ulong hold_ns;
+    atomic_ulong max_hold_ns;
+};
+
+static struct lock_profile_site sites[LOCK_PROFILE_SITES];
+static struct lock_profile_site overflow_site;
+
+static struct lock_profile_site *
+lock_profile_site(const char *where)
+{
+    const char *current;
+    size_t idx;
+
+    if (!where) {
+        where = "<unknown>";
+    }
+    idx = ((uintptr_t)where * 0x9e3779b97f4a7c15ULL) >> 32;
+    for (size_t i = 0; i < LOCK_PROFILE_SITES; i++) {
+        struct lock_profile_site *site;
+        site = &sites[(idx + i) & (LOCK_PROFILE_SITES - 1)];
+        current = atomic_load_explicit(&site->where, memory_order_acquire);
+        if (current == where) {
+            return site;
+        }
+        if (!current) {
+            if (atomic_compare_exchange_strong(&site->where, &current,
+                                               where) ||
+                current == where) {
+                return site;
+            }
+        }
+    }
+    return &overflow_site;
+}
+
+static inline void
+lock_profile_max(atomic_ulong *max, uint64_t value)
+{
+    uint64_t current = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > current &&
+           !atomic_compare_exchange_weak_explicit(max, &current, value,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed));
+}
+
+void
+lock_profile_record_acquire(const char *where, uint64_t wait_ns,
+                            bool contended)
+{
+    struct lock_profile_site *site = lock_profile_site(where);
+
+    atomic_fetch_add_explicit(&site->acquisitions, 1, memory_order_relaxed);
+    if (contended) {
+        atomic_fetch_add_explicit(&site->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&site->wait_ns, wait_ns,
+                                  memory_order_relaxed);
+        lock_profile_max(&site->max_wait_ns, wait_ns);
+    }
+}
+
+void
+lock_profile_record_release(const char *where, uint64_t hold_ns)
+{
+    struct lock_profile_site *site = lock_profile_site(where);
+
+    atomic_fetch_add_explicit(&site->hold_ns, hold_ns, memory_order_relaxed);
+    lock_profile_max(&site->max_hold_ns, hold_ns);
+}
+
+#ifdef LOCK_PROFILE
+/* Sorts sites by total wait time, highest first */
+static int
+lock_profile_compare(const void *a, const void *b)
+{
+    const struct lock_profile_site *const *x = a;
+    const struct lock_profile_site *const *y = b;
+    uint64_t wx = atomic_load(&(*x)->wait_ns);
+    uint64_t wy = atomic_load(&(*y)->wait_ns);
+    return (wx < wy) - (wx > wy);
+}
+#endif
+
+void
+lock_profile_report(FILE *dst, int top_n)
+{
+#ifndef LOCK_PROFILE
+    (void) top_n;
+    fprintf(dst, "Lock profiling is disabled, build with -DLOCK_PROFILE\n");
+#else
+    struct lock_profile_site *list[LOCK_PROFILE_SITES + 1];
+    struct lock_profile_site *site;
+    uint64_t acquisitions;
+    int count = 0;
+
+    for (int i = 0; i <= LOCK_PROFILE_SITES; i++) {
+        site = i < LOCK_PROFILE_SITES ? &sites[i] : &overflow_site;
+        if (atomic_load(&site->acquisitions)) {
+            list[count++] = site;
+        }
+    }
+    qsort(list, count, sizeof(*list), lock_profile_compare);
+    if (top_n > 0) {
+        count = MIN(count, top_n);
+    }
+
+    fprintf(dst, "%-40s %12s %10s %12s %12s %12s %12s\n",
+            "site", "acquisitions", "contended", "wait (ms)", "max wait (us)",
+            "avg hold (ns)", "max hold (us)");
+    for (int i = 0; i < count; i++) {
+        site = list[i];
+        acquisitions = atomic_load(&site->acquisitions);
+        fprintf(dst, "%-40s %12lu %9.2lf%% %12.3lf %12.3lf %12.1lf %12.3lf\n",
+                site == &overflow_site ? "<other>" : atomic_load(&site->where),
+                acquisitions,
+                100.0 * atomic_load(&site->contended) / acquisitions,
+                atomic_load(&site->wait_ns) / 1e6,
+                atomic_load(&site->max_wait_ns) / 1e3,
+                (double)atomic_load(&site->hold_ns) / acquisitions,
+                atomic_load(&site->max_hold_ns) / 1e3);
+    }
+#endif
+}
+
+void
+lock_profile_reset(void)
+{
+    for (int i = 0; i <= LOCK_PROFILE_SITES; i++) {
+        struct lock_profile_site *site;
+        site = i < LOCK_PROFILE_SITES ? &sites[i] : &overflow_site;
+        atomic_store(&site->acquisitions, 0);
+        atomic_store(&site->contended, 0);
+        atomic_store(&site->wait_ns, 0);
+        atomic_store(&site->max_wait_ns, 0);
+        atomic_store(&site->hold_ns, 0);
+        atomic_store(&site->max_hold_ns, 0);
+    }
+}
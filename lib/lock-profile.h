@@ -0,0 +1,85 @@
+#ifndef _LOCK_PROFILE_H
+#define _LOCK_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "perf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Lock contention profiler. When built with -DLOCK_PROFILE, the locks in
+ * "locks.h" record per lock site (the "where" string of the caller's
+ * SOURCE_LOCATOR) the number of acquisitions, the number of contended
+ * acquisitions, the total and max time spent waiting, and the total and max
+ * time the lock was held. Sites are reported sorted by total wait time.
+ * Without LOCK_PROFILE, the hooks compile to nothing. The whole library must
+ * be built with the same setting. */
+
+#ifdef LOCK_PROFILE
+
+/* Embedded in every profiled lock */
+struct lock_profile {
+    uint64_t acquired_ns;
+};
+
+#define LOCK_PROFILE_MEMBER struct lock_profile profile;
+
+/* Starts measuring the wait in "START" once a lock turns out to be held */
+#define LOCK_PROFILE_WAIT(START) \
+    ((START) = (START) ? (START) : get_time_ns())
+
+#define LOCK_PROFILE_ACQUIRED(LOCK, WHERE, START) \
+    lock_profile_acquired__(&(LOCK)->profile, WHERE, START)
+
+#define LOCK_PROFILE_RELEASED(LOCK, WHERE) \
+    lock_profile_released__(&(LOCK)->profile, WHERE)
+
+#else
+
+#define LOCK_PROFILE_MEMBER
+#define LOCK_PROFILE_WAIT(START) ((void)(START))
+#define LOCK_PROFILE_ACQUIRED(LOCK, WHERE, START) ((void)(START))
+#define LOCK_PROFILE_RELEASED(LOCK, WHERE)
+
+#endif
+
+/* Prints the "top_n" lock sites with the highest total wait time to "dst".
+ * Set "top_n" to 0 to print all sites. */
+void lock_profile_report(FILE *dst, int top_n);
+
+/* Clears all recorded statistics */
+void lock_profile_reset(void);
+
+/* Record events of the lock site "where". Called by the macros above. */
+void lock_profile_record_acquire(const char *where, uint64_t wait_ns,
+                                 bool contended);
+void lock_profile_record_release(const char *where, uint64_t hold_ns);
+
+#ifdef LOCK_PROFILE
+
+static inline void
+lock_profile_acquired__(struct lock_profile *profile, const char *where,
+                        uint64_t wait_start)
+{
+    uint64_t now = get_time_ns();
+    profile->acquired_ns = now;
+    lock_profile_record_acquire(where, wait_start ? now - wait_start : 0,
+                                wait_start != 0);
+}
+
+static inline void
+lock_profile_released__(struct lock_profile *profile, const char *where)
+{
+    lock_profile_record_release(where, get_time_ns() - profile->acquired_ns);
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,22 +3,57 @@
 
 #ifndef __cplusplus
 #include <stdatomic.h>
+#define LOCKS_ATOMIC(T) _Atomic(T)
 #else
 #include <atomic>
+/* Lets the C11 atomics below compile as C++ */
+#define LOCKS_ATOMIC(T) std::atomic<T>
+using std::atomic_uint;
+using std::atomic_init;
+using std::atomic_load_explicit;
+using std::atomic_store_explicit;
+using std::atomic_exchange_explicit;
+using std::atomic_fetch_add_explicit;
+using std::atomic_fetch_sub_explicit;
+using std::atomic_compare_exchange_strong_explicit;
+using std::atomic_thread_fence;
+using std::memory_order_relaxed;
+using std::memory_order_acquire;
+using std::memory_order_release;
+using std::memory_order_acq_rel;
+using std::memory_order_seq_cst;
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 #include <pthread.h>
 #include "util.h"
+#include "futex.h"
+#include "lock-profile.h"
 
 /* ===== Spinlock  ===== */
 
+/* Test-and-test-and-set lock. Waiters spin on plain loads, so the lock's
+ * cache line stays shared until it is released, and back off exponentially
+ * between loads. Build with -DSPINLOCK_STATS to count contention per lock. */
+
+/* Upper bound of "cpu_relax" calls between loads of a held lock */
+#define SPINLOCK_MAX_BACKOFF 64
+
+struct spinlock_stats {
+    uint64_t acquisitions;
+    uint64_t contended;     /* Acquisitions that found the lock held */
+    uint64_t spins;         /* Backoff rounds while waiting */
+};
+
 struct spinlock {
     const char *where;
-#ifndef __cplusplus
     atomic_uint value;
-#else
-    std::atomic<uint32_t> value;
+    LOCK_PROFILE_MEMBER
+#ifdef SPINLOCK_STATS
+    struct spinlock_stats stats;  /* Updated by the lock holder */
 #endif
 };
 
@@ -35,11 +70,188 @@ static inline void spinlock_lock_at(struct spinlock *spin, const char *where);
 static inline void spinlock_unlock(struct spinlock *spin);
 static inline bool spinlock_is_locked(struct spinlock *spin);
 
+/* Copies the contention counters of "spin" into "stats". All zeros unless
+ * built with SPINLOCK_STATS. Exact only while no thread holds "spin". */
+static inline void spinlock_get_stats(struct spinlock *spin,
+                                      struct spinlock_stats *stats);
+
+/* ===== Ticket lock  ===== */
+
+/* FIFO spinlock. Each thread takes a ticket and waits until it is served,
+ * backing off in proportion to the number of threads ahead of it. */
+
+/* "cpu_relax" calls per waiting thread ahead in line */
+#define TICKETLOCK_BACKOFF 16
+
+struct ticketlock {
+    const char *where;
+    atomic_uint next;   /* Next ticket to hand out */
+    atomic_uint owner;  /* Ticket being served */
+    LOCK_PROFILE_MEMBER
+};
+
+static inline void ticketlock_init(struct ticketlock *lock);
+static inline void ticketlock_destroy(struct ticketlock *lock);
+
+#define ticketlock_lock(lock) ticketlock_lock_at(lock, SOURCE_LOCATOR)
+#define ticketlock_try_lock(lock) ticketlock_try_lock_at(lock, SOURCE_LOCATOR)
+
+static inline void ticketlock_lock_at(struct ticketlock *lock,
+                                      const char *where);
+static inline int ticketlock_try_lock_at(struct ticketlock *lock,
+                                         const char *where);
+static inline void ticketlock_unlock(struct ticketlock *lock);
+static inline bool ticketlock_is_locked(struct ticketlock *lock);
+
+/* ===== MCS lock  ===== */
+
+/* FIFO queue lock by Mellor-Crummey and Scott. Each waiter spins on a flag
+ * in its own queue node, so a handoff touches only the next waiter's cache
+ * line. The caller provides the node, e.g., on its stack, and must pass the
+ * same node to "mcslock_unlock". A node holds one lock at a time.
+ *
+ * Usage example:
+ *
+ * struct mcs_node node;
+ * mcslock_lock(&lock, &node);
+ * ...
+ * mcslock_unlock(&lock, &node);
+ */
+
+ALIGNED_STRUCT(CACHE_LINE_SIZE, mcs_node) {
+    LOCKS_ATOMIC(struct mcs_node *) next;
+    atomic_uint locked;
+};
+
+struct mcslock {
+    const char *where;
+    LOCKS_ATOMIC(struct mcs_node *) tail;
+    LOCK_PROFILE_MEMBER
+};
+
+static inline void mcslock_init(struct mcslock *lock);
+static inline void mcslock_destroy(struct mcslock *lock);
+
+#define mcslock_lock(lock, node) mcslock_lock_at(lock, node, SOURCE_LOCATOR)
+#define mcslock_try_lock(lock, node) \
+    mcslock_try_lock_at(lock, node, SOURCE_LOCATOR)
+
+static inline void mcslock_lock_at(struct mcslock *lock,
+                                   struct mcs_node *node, const char *where);
+static inline int mcslock_try_lock_at(struct mcslock *lock,
+                                      struct mcs_node *node,
+                                      const char *where);
+static inline void mcslock_unlock(struct mcslock *lock,
+                                  struct mcs_node *node);
+static inline bool mcslock_is_locked(struct mcslock *lock);
+
+/* ===== Reader-writer lock  ===== */
+
+/* Writer-preferring reader-writer spinlock. New readers wait while a writer
+ * holds or waits for the lock, so a stream of readers cannot starve
+ * writers. Read locks are not recursive: a nested read lock deadlocks once
+ * a writer waits. All readers update the same word; for read-mostly data
+ * accessed from many cores use "struct brlock". */
+
+/* Set in "state" while a writer holds the lock */
+#define RWLOCK_WRITER (1u << 31)
+
+struct rwlock {
+    const char *where;              /* Of the writer */
+    atomic_uint state;              /* RWLOCK_WRITER | number of readers */
+    atomic_uint writers_waiting;
+    LOCK_PROFILE_MEMBER
+};
+
+static inline void rwlock_init(struct rwlock *lock);
+static inline void rwlock_destroy(struct rwlock *lock);
+
+#define rwlock_write_lock(lock) rwlock_write_lock_at(lock, SOURCE_LOCATOR)
+
+static inline void rwlock_read_lock(struct rwlock *lock);
+static inline int rwlock_try_read_lock(struct rwlock *lock);
+static inline void rwlock_read_unlock(struct rwlock *lock);
+static inline void rwlock_write_lock_at(struct rwlock *lock,
+                                        const char *where);
+static inline int rwlock_try_write_lock_at(struct rwlock *lock,
+                                           const char *where);
+static inline void rwlock_write_unlock(struct rwlock *lock);
+
+/* ===== Big reader lock  ===== */
+
+/* Distributed reader-writer lock. Each reader increments a counter in the
+ * slot of the CPU it runs on, and every slot sits on its own cache line, so
+ * readers on different cores do not write a shared line, unless there are
+ * fewer slots than CPUs or a reader migrates while it holds the lock. A
+ * writer raises a flag, then waits for all slots to drain, so writing costs
+ * O(slots). "brlock_read_lock" returns the slot it used, which must be
+ * passed to "brlock_read_unlock". */
+
+ALIGNED_STRUCT(CACHE_LINE_SIZE, brlock_slot) {
+    atomic_uint readers;
+};
+
+struct brlock {
+    const char *where;              /* Of the writer */
+    struct brlock_slot *slots;
+    unsigned int mask;              /* Number of slots - 1 */
+    LOCK_PROFILE_MEMBER
+    ALIGNED_VAR(CACHE_LINE_SIZE) atomic_uint writer;
+};
+
+/* Initiates "lock" with at least "slots" reader slots. Set "slots" to 0
+ * for one slot per online CPU. */
+static inline void brlock_init(struct brlock *lock, unsigned int slots);
+static inline void brlock_destroy(struct brlock *lock);
+
+#define brlock_write_lock(lock) brlock_write_lock_at(lock, SOURCE_LOCATOR)
+
+static inline unsigned int brlock_read_lock(struct brlock *lock);
+static inline void brlock_read_unlock(struct brlock *lock, unsigned int slot);
+static inline void brlock_write_lock_at(struct brlock *lock,
+                                        const char *where);
+static inline void brlock_write_unlock(struct brlock *lock);
+
+/* ===== Sequence lock  ===== */
+
+/* For small records that are read often and written rarely. Readers never
+ * write shared memory: they read the record optimistically and retry if a
+ * writer was active meanwhile. Writers are serialized with a spinlock. Read
+ * the protected fields using relaxed atomic loads, as they may change while
+ * being read.
+ *
+ * Usage example:
+ *
+ * uint32_t seq;
+ * do {
+ *     seq = seqlock_read_begin(&lock);
+ *     x = atomic_load_explicit(&record.x, memory_order_relaxed);
+ *     y = atomic_load_explicit(&record.y, memory_order_relaxed);
+ * } while (seqlock_read_retry(&lock, seq));
+ */
+
+struct seqlock {
+    atomic_uint seq;            /* Odd while a writer is active */
+    struct spinlock writer;
+};
+
+static inline void seqlock_init(struct seqlock *lock);
+static inline void seqlock_destroy(struct seqlock *lock);
+
+#define seqlock_write_lock(lock) seqlock_write_lock_at(lock, SOURCE_LOCATOR)
+
+static inline void seqlock_write_lock_at(struct seqlock *lock,
+                                         const char *where);
+static inline void seqlock_write_unlock(struct seqlock *lock);
+static inline uint32_t seqlock_read_begin(struct seqlock *lock);
+static inline bool seqlock_read_retry(struct seqlock *lock, uint32_t seq);
+
 /* ===== Mutex  ===== */
 
 struct mutex {
     const char *where;
     pthread_mutex_t lock;
+    LOCK_PROFILE_MEMBER
 };
 
 static inline void mutex_init(struct mutex *mutex);
@@ -50,16 +262,43 @@ static inline void mutex_destroy(struct mutex *mutex);
 static inline void mutex_lock_at(struct mutex *mutex_, const char *where);
 static inline void mutex_unlock(struct mutex *mutex_);
 
+/* ===== Futex mutex  ===== */
+
+/* Mutex that spins briefly and then parks in the kernel. The word is 0 when
+ * unlocked, 1 when locked, and 2 when locked with possible waiters, so
+ * uncontended lock and unlock are a single atomic operation each (Drepper,
+ * "Futexes Are Tricky"). */
+
+/* Attempts to grab a held lock before parking */
+#define FMUTEX_SPIN 100
+
+struct fmutex {
+    const char *where;
+    atomic_uint value;
+    LOCK_PROFILE_MEMBER
+};
+
+static inline void fmutex_init(struct fmutex *mutex);
+static inline void fmutex_destroy(struct fmutex *mutex);
+
+#define fmutex_lock(mutex) fmutex_lock_at(mutex, SOURCE_LOCATOR)
+#define fmutex_try_lock(mutex) fmutex_try_lock_at(mutex, SOURCE_LOCATOR)
+
+static inline void fmutex_lock_at(struct fmutex *mutex, const char *where);
+static inline int fmutex_try_lock_at(struct fmutex *mutex, const char *where);
+static inline void fmutex_unlock(struct fmutex *mutex);
+
 /* ===== Condition variables  ===== */
 
+/* A gate that threads wait on while it is locked. The word is 0 when open,
+ * 1 when locked, and 2 when locked with possible waiters. Waiting on an open
+ * gate is a single load; waiters spin briefly and then park on the futex. */
+
+/* Polls of a locked gate before parking */
+#define COND_SPIN 100
+
 struct cond {
-    pthread_cond_t cond;
-    struct mutex mutex;
-#ifndef __cplusplus
     atomic_uint value;
-#else
-    std::atomic<uint32_t> value;
-#endif
 };
 
 #define cond_wait(cond) cond_wait_at(cond, SOURCE_LOCATOR);
@@ -78,12 +317,11 @@ spinlock_init(struct spinlock *spin)
     if (!spin) {
         return;
     }
-#ifndef __cplusplus
     atomic_init(&spin->value, 0);
-#else
-    spin->value.store(0, std::memory_order_release);
-#endif
     spin->where = NULL;
+#ifdef SPINLOCK_STATS
+    memset(&spin->stats, 0, sizeof(spin->stats));
+#endif
 }
 
 static inline void
@@ -92,67 +330,81 @@ spinlock_destroy(struct spinlock *spin)
     if (!spin) {
         return;
     }
-#ifndef __cplusplus
-    ASSERT(atomic_load(&spin->value)==0);
-#else
-    ASSERT(spin->value.load(std::memory_order_acquire)==0);
-#endif
+    ASSERT(atomic_load_explicit(&spin->value, memory_order_relaxed) == 0);
     spin->where = NULL;
 }
 
+/* Spins until "spin" looks free. Returns the number of backoff rounds. */
+static inline uint64_t
+spinlock_backoff__(struct spinlock *spin)
+{
+    unsigned int backoff = 1;
+    uint64_t rounds = 0;
+
+    do {
+        for (unsigned int i = 0; i < backoff; i++) {
+            cpu_relax();
+        }
+        backoff = MIN(backoff * 2, SPINLOCK_MAX_BACKOFF);
+        rounds++;
+    } while (atomic_load_explicit(&spin->value, memory_order_relaxed));
+    return rounds;
+}
+
 static inline void
 spinlock_lock_at(struct spinlock *spin, const char *where)
 {
+    uint64_t wait_start = 0;
+    uint64_t spins = 0;
+
     if (!spin) {
         return;
     }
-    uint32_t zero = 0;
-#ifndef __cplusplus
-    while (!atomic_compare_exchange_strong(&spin->value, &zero, 1)) {
-        zero=0;
+    while (atomic_exchange_explicit(&spin->value, 1, memory_order_acquire)) {
+        LOCK_PROFILE_WAIT(wait_start);
+        spins += spinlock_backoff__(spin);
     }
+    spin->where = where;
+    LOCK_PROFILE_ACQUIRED(spin, where, wait_start);
+#ifdef SPINLOCK_STATS
+    spin->stats.acquisitions++;
+    spin->stats.contended += spins > 0;
+    spin->stats.spins += spins;
 #else
-    while(!spin->value.compare_exchange_strong(zero, 1,
-                                               std::memory_order_seq_cst)) {
-        zero = 0;
-    }
+    (void)spins;
 #endif
-    spin->where = where;
 }
 
 /* Returns 1 iff the lock succeeded */
 static inline int
 spinlock_try_lock_at(struct spinlock *spin, const char *where)
 {
-    int result;
     if (!spin) {
         return 0;
     }
-    uint32_t zero = 0;
-#ifndef __cplusplus
-    result = atomic_compare_exchange_strong(&spin->value, &zero, 1);
-#else
-    result =
-       spin->value.compare_exchange_strong(zero, 1, std::memory_order_seq_cst);
-#endif
-    if (result) {
-        spin->where = where;
+    if (atomic_load_explicit(&spin->value, memory_order_relaxed) ||
+        atomic_exchange_explicit(&spin->value, 1, memory_order_acquire)) {
+        return 0;
     }
-    return result;
+    spin->where = where;
+    LOCK_PROFILE_ACQUIRED(spin, where, 0);
+#ifdef SPINLOCK_STATS
+    spin->stats.acquisitions++;
+#endif
+    return 1;
 }
 
+/* Waits until "spin" is free, without locking it */
 static inline void
 spinlock_wait_at(struct spinlock *spin, const char *where)
 {
     if (!spin) {
         return;
     }
-#ifndef __cplusplus
-    while (atomic_load(&spin->value)==1);
-#else
-    while (spin->value.load(std::memory_order_acquire)==1);
-#endif
-    spin->where = where;
+    while (atomic_load_explicit(&spin->value, memory_order_acquire)) {
+        spinlock_backoff__(spin);
+    }
+    (void)where;
 }
 
 static inline void
@@ -161,26 +413,451 @@ spinlock_unlock(struct spinlock *spin)
     if (!spin) {
         return;
     }
-#ifndef __cplusplus
-    ASSERT(atomic_load(&spin->value)==1);
-    atomic_store(&spin->value, 0);
-#else
-    ASSERT(spin->value.load(std::memory_order_acquire)==1);
-    spin->value.store(0, std::memory_order_release);
-#endif
+    ASSERT(atomic_load_explicit(&spin->value, memory_order_relaxed) == 1);
+    LOCK_PROFILE_RELEASED(spin, spin->where);
     spin->where = NULL;
+    atomic_store_explicit(&spin->value, 0, memory_order_release);
 }
 
 static inline bool
 spinlock_is_locked(struct spinlock *spin)
 {
-#ifndef __cplusplus
-    return atomic_load(&spin->value)==1;
+    return atomic_load_explicit(&spin->value, memory_order_acquire) == 1;
+}
+
+static inline void
+spinlock_get_stats(struct spinlock *spin, struct spinlock_stats *stats)
+{
+#ifdef SPINLOCK_STATS
+    *stats = spin->stats;
 #else
-    return spin->value.load(std::memory_order_acquire) == 1;
+    (void)spin;
+    memset(stats, 0, sizeof(*stats));
 #endif
 }
 
+static inline void
+ticketlock_init(struct ticketlock *lock)
+{
+    atomic_init(&lock->next, 0);
+    atomic_init(&lock->owner, 0);
+    lock->where = NULL;
+}
+
+static inline void
+ticketlock_destroy(struct ticketlock *lock)
+{
+    ASSERT(!ticketlock_is_locked(lock));
+    lock->where = NULL;
+}
+
+static inline void
+ticketlock_lock_at(struct ticketlock *lock, const char *where)
+{
+    uint32_t ticket = atomic_fetch_add_explicit(&lock->next, 1,
+                                                memory_order_relaxed);
+    uint64_t wait_start = 0;
+    uint32_t owner;
+
+    while ((owner = atomic_load_explicit(&lock->owner, memory_order_acquire))
+           != ticket) {
+        LOCK_PROFILE_WAIT(wait_start);
+        for (uint32_t i = 0; i < (ticket - owner) * TICKETLOCK_BACKOFF; i++) {
+            cpu_relax();
+        }
+    }
+    lock->where = where;
+    LOCK_PROFILE_ACQUIRED(lock, where, wait_start);
+}
+
+/* Returns 1 iff the lock succeeded */
+static inline int
+ticketlock_try_lock_at(struct ticketlock *lock, const char *where)
+{
+    /* Pairs with the release in "ticketlock_unlock": winning the exchange
+     * on "next" alone does not order the previous critical section */
+    uint32_t owner = atomic_load_explicit(&lock->owner,
+                                          memory_order_acquire);
+    uint32_t ticket = owner;
+
+    if (!atomic_compare_exchange_strong_explicit(&lock->next, &ticket,
+                                                 owner + 1,
+                                                 memory_order_acquire,
+                                                 memory_order_relaxed)) {
+        return 0;
+    }
+    lock->where = where;
+    LOCK_PROFILE_ACQUIRED(lock, where, 0);
+    return 1;
+}
+
+static inline void
+ticketlock_unlock(struct ticketlock *lock)
+{
+    /* Only the holder writes "owner" */
+    uint32_t owner = atomic_load_explicit(&lock->owner, memory_order_relaxed);
+
+    ASSERT(ticketlock_is_locked(lock));
+    LOCK_PROFILE_RELEASED(lock, lock->where);
+    lock->where = NULL;
+    atomic_store_explicit(&lock->owner, owner + 1, memory_order_release);
+}
+
+static inline bool
+ticketlock_is_locked(struct ticketlock *lock)
+{
+    return atomic_load_explicit(&lock->next, memory_order_relaxed) !=
+           atomic_load_explicit(&lock->owner, memory_order_relaxed);
+}
+
+static inline void
+mcslock_init(struct mcslock *lock)
+{
+    atomic_init(&lock->tail, NULL);
+    lock->where = NULL;
+}
+
+static inline void
+mcslock_destroy(struct mcslock *lock)
+{
+    ASSERT(!mcslock_is_locked(lock));
+    lock->where = NULL;
+}
+
+static inline void
+mcslock_lock_at(struct mcslock *lock, struct mcs_node *node,
+                const char *where)
+{
+    uint64_t wait_start = 0;
+    struct mcs_node *prev;
+
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->locked, 1, memory_order_relaxed);
+    prev = atomic_exchange_explicit(&lock->tail, node, memory_order_acq_rel);
+    if (prev) {
+        LOCK_PROFILE_WAIT(wait_start);
+        /* Link behind the previous waiter and spin on our own node */
+        atomic_store_explicit(&prev->next, node, memory_order_release);
+        while (atomic_load_explicit(&node->locked, memory_order_acquire)) {
+            cpu_relax();
+        }
+    }
+    lock->where = where;
+    LOCK_PROFILE_ACQUIRED(lock, where, wait_start);
+}
+
+/* Returns 1 iff the lock succeeded */
+static inline int
+mcslock_try_lock_at(struct mcslock *lock, struct mcs_node *node,
+                    const char *where)
+{
+    struct mcs_node *expected = NULL;
+
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&lock->tail, &expected, node,
+                                                 memory_order_acquire,
+                                                 memory_order_relaxed)) {
+        return 0;
+    }
+    lock->where = where;
+    LOCK_PROFILE_ACQUIRED(lock, where, 0);
+    return 1;
+}
+
+static inline void
+mcslock_unlock(struct mcslock *lock, struct mcs_node *node)
+{
+    struct mcs_node *next;
+    struct mcs_node *expected = node;
+
+    LOCK_PROFILE_RELEASED(lock, lock->where);
+    lock->where = NULL;
+    next = atomic_load_explicit(&node->next, memory_order_acquire);
+    if (!next) {
+        /* No known successor, try to mark the lock as free */
+        if (atomic_compare_exchange_strong_explicit(&lock->tail, &expected,
+                                                    NULL,
+                                                    memory_order_release,
+                                                    memory_order_relaxed)) {
+            return;
+        }
+        /* A successor swapped the tail but has not linked itself yet */
+        while (!(next = atomic_load_explicit(&node->next,
+                                             memory_order_acquire))) {
+            cpu_relax();
+        }
+    }
+    atomic_store_explicit(&next->locked, 0, memory_order_release);
+}
+
+static inline bool
+mcslock_is_locked(struct mcslock *lock)
+{
+    return atomic_load_explicit(&lock->tail, memory_order_relaxed) != NULL;
+}
+
+static inline void
+rwlock_init(struct rwlock *lock)
+{
+    atomic_init(&lock->state, 0);
+    atomic_init(&lock->writers_waiting, 0);
+    lock->where = NULL;
+}
+
+static inline void
+rwlock_destroy(struct rwlock *lock)
+{
+    ASSERT(atomic_load_explicit(&lock->state, memory_order_relaxed) == 0);
+    lock->where = NULL;
+}
+
+/* Returns 1 iff the lock succeeded */
+static inline int
+rwlock_try_read_lock(struct rwlock *lock)
+{
+    uint32_t state;
+
+    if (atomic_load_explicit(&lock->writers_waiting, memory_order_relaxed)) {
+        return 0;
+    }
+    state = atomic_fetch_add_explicit(&lock->state, 1, memory_order_acquire);
+    if (state & RWLOCK_WRITER) {
+        atomic_fetch_sub_explicit(&lock->state, 1, memory_order_relaxed);
+        return 0;
+    }
+    return 1;
+}
+
+static inline void
+rwlock_read_lock(struct rwlock *lock)
+{
+    while (!rwlock_try_read_lock(lock)) {
+        while (atomic_load_explicit(&lock->writers_waiting,
+                                    memory_order_relaxed) ||
+               (atomic_load_explicit(&lock->state, memory_order_relaxed) &
+                RWLOCK_WRITER)) {
+            cpu_relax();
+        }
+    }
+}
+
+static inline void
+rwlock_read_unlock(struct rwlock *lock)
+{
+    ASSERT(atomic_load_explicit(&lock->state, memory_order_relaxed) &
+           ~RWLOCK_WRITER);
+    atomic_fetch_sub_explicit(&lock->state, 1, memory_order_release);
+}
+
+static inline bool
+rwlock_try_write_lock__(struct rwlock *lock)
+{
+    uint32_t expected = 0;
+
+    return atomic_compare_exchange_strong_explicit(&lock->state, &expected,
+                                                   RWLOCK_WRITER,
+                                                   memory_order_acquire,
+                                                   memory_order_relaxed);
+}
+
+/* Returns 1 iff the lock succeeded */
+static inline int
+rwlock_try_write_lock_at(struct rwlock *lock, const char *where)
+{
+    if (!rwlock_try_write_lock__(lock)) {
+        return 0;
+    }
+    lock->where = where;
+    LOCK_PROFILE_ACQUIRED(lock, where, 0);
+    return 1;
+}
+
+static inline void
+rwlock_write_lock_at(struct rwlock *lock, const char *where)
+{
+    uint64_t wait_start = 0;
+
+    /* Holds new readers back while waiting for current ones to leave */
+    atomic_fetch_add_explicit(&lock->writers_waiting, 1,
+                              memory_order_relaxed);
+    while (!rwlock_try_write_lock__(lock)) {
+        LOCK_PROFILE_WAIT(wait_start);
+        while (atomic_load_explicit(&lock->state, memory_order_relaxed)) {
+            cpu_relax();
+        }
+    }
+    atomic_fetch_sub_explicit(&lock->writers_waiting, 1,
+                              memory_order_relaxed);
+    lock->where = where;
+    LOCK_PROFILE_ACQUIRED(lock, where, wait_start);
+}
+
+static inline void
+rwlock_write_unlock(struct rwlock *lock)
+{
+    ASSERT(atomic_load_explicit(&lock->state, memory_order_relaxed) &
+           RWLOCK_WRITER);
+    LOCK_PROFILE_RELEASED(lock, lock->where);
+    lock->where = NULL;
+    /* Readers that back off may still hold transient counts */
+    atomic_fetch_sub_explicit(&lock->state, RWLOCK_WRITER,
+                              memory_order_release);
+}
+
+static inline void
+brlock_init(struct brlock *lock, unsigned int slots)
+{
+    unsigned int size = 1;
+
+    /* Configured rather than online CPUs, as CPU numbers may have gaps */
+    if (!slots) {
+        long cpus = sysconf(_SC_NPROCESSORS_CONF);
+        slots = cpus > 0 ? cpus : 1;
+    }
+    while (size < slots) {
+        size <<= 1;
+    }
+
+    lock->slots = (struct brlock_slot *)
+                  xmalloc_cacheline(sizeof(*lock->slots) * size);
+    lock->mask = size - 1;
+    for (unsigned int i = 0; i < size; i++) {
+        atomic_init(&lock->slots[i].readers, 0);
+    }
+    atomic_init(&lock->writer, 0);
+    lock->where = NULL;
+}
+
+static inline void
+brlock_destroy(struct brlock *lock)
+{
+    ASSERT(!atomic_load_explicit(&lock->writer, memory_order_relaxed));
+    free_cacheline(lock->slots);
+    lock->slots = NULL;
+    lock->where = NULL;
+}
+
+static inline unsigned int
+brlock_read_lock(struct brlock *lock)
+{
+    unsigned int index = current_cpu() & lock->mask;
+    struct brlock_slot *slot = &lock->slots[index];
+
+    while (1) {
+        /* Sequentially consistent, so that either the writer sees our
+         * count, or we see its flag */
+        atomic_fetch_add_explicit(&slot->readers, 1, memory_order_seq_cst);
+        if (!atomic_load_explicit(&lock->writer, memory_order_seq_cst)) {
+            return index;
+        }
+        atomic_fetch_sub_explicit(&slot->readers, 1, memory_order_release);
+        while (atomic_load_explicit(&lock->writer, memory_order_relaxed)) {
+            cpu_relax();
+        }
+    }
+}
+
+static inline void
+brlock_read_unlock(struct brlock *lock, unsigned int slot)
+{
+    atomic_fetch_sub_explicit(&lock->slots[slot].readers, 1,
+                              memory_order_release);
+}
+
+static inline void
+brlock_write_lock_at(struct brlock *lock, const char *where)
+{
+    uint64_t wait_start = 0;
+    uint32_t expected = 0;
+
+    /* Writers exclude each other using the flag itself */
+    while (!atomic_compare_exchange_strong_explicit(&lock->writer, &expected,
+                                                    1, memory_order_seq_cst,
+                                                    memory_order_relaxed)) {
+        LOCK_PROFILE_WAIT(wait_start);
+        while (atomic_load_explicit(&lock->writer, memory_order_relaxed)) {
+            cpu_relax();
+        }
+        expected = 0;
+    }
+    for (unsigned int i = 0; i <= lock->mask; i++) {
+        while (atomic_load_explicit(&lock->slots[i].readers,
+                                    memory_order_seq_cst)) {
+            LOCK_PROFILE_WAIT(wait_start);
+            cpu_relax();
+        }
+    }
+    lock->where = where;
+    LOCK_PROFILE_ACQUIRED(lock, where, wait_start);
+}
+
+static inline void
+brlock_write_unlock(struct brlock *lock)
+{
+    ASSERT(atomic_load_explicit(&lock->writer, memory_order_relaxed));
+    LOCK_PROFILE_RELEASED(lock, lock->where);
+    lock->where = NULL;
+    atomic_store_explicit(&lock->writer, 0, memory_order_release);
+}
+
+static inline void
+seqlock_init(struct seqlock *lock)
+{
+    atomic_init(&lock->seq, 0);
+    spinlock_init(&lock->writer);
+}
+
+static inline void
+seqlock_destroy(struct seqlock *lock)
+{
+    spinlock_destroy(&lock->writer);
+}
+
+static inline void
+seqlock_write_lock_at(struct seqlock *lock, const char *where)
+{
+    uint32_t seq;
+
+    spinlock_lock_at(&lock->writer, where);
+    seq = atomic_load_explicit(&lock->seq, memory_order_relaxed);
+    atomic_store_explicit(&lock->seq, seq + 1, memory_order_relaxed);
+    /* Orders the odd sequence before the writer's stores to the record */
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void
+seqlock_write_unlock(struct seqlock *lock)
+{
+    uint32_t seq = atomic_load_explicit(&lock->seq, memory_order_relaxed);
+
+    ASSERT(seq & 1);
+    atomic_store_explicit(&lock->seq, seq + 1, memory_order_release);
+    spinlock_unlock(&lock->writer);
+}
+
+/* Returns the sequence to pass to "seqlock_read_retry". Waits while a
+ * writer is active. */
+static inline uint32_t
+seqlock_read_begin(struct seqlock *lock)
+{
+    uint32_t seq;
+
+    while ((seq = atomic_load_explicit(&lock->seq, memory_order_acquire)) & 1) {
+        cpu_relax();
+    }
+    return seq;
+}
+
+/* Returns true iff the record may have changed since "seqlock_read_begin"
+ * returned "seq", in which case the reader must read it again */
+static inline bool
+seqlock_read_retry(struct seqlock *lock, uint32_t seq)
+{
+    /* Orders the reader's loads of the record before the check */
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&lock->seq, memory_order_relaxed) != seq;
+}
+
 static inline void
 mutex_init(struct mutex *mutex)
 {
@@ -200,13 +877,19 @@ mutex_destroy(struct mutex *mutex)
 static inline void
 mutex_lock_at(struct mutex *mutex, const char *where)
 {
+    uint64_t wait_start = 0;
+
     if (!mutex) {
         return;
     }
-    if (pthread_mutex_lock(&mutex->lock)) {
-        abort_msg("pthread_mutex_lock fail");
+    if (pthread_mutex_trylock(&mutex->lock)) {
+        LOCK_PROFILE_WAIT(wait_start);
+        if (pthread_mutex_lock(&mutex->lock)) {
+            abort_msg("pthread_mutex_lock fail");
+        }
     }
     mutex->where = where;
+    LOCK_PROFILE_ACQUIRED(mutex, where, wait_start);
 }
 
 static inline void
@@ -215,94 +898,153 @@ mutex_unlock(struct mutex *mutex)
     if (!mutex) {
         return;
     }
+    LOCK_PROFILE_RELEASED(mutex, mutex->where);
+    mutex->where = NULL;
     if (pthread_mutex_unlock(&mutex->lock)) {
         abort_msg("pthread_mutex_unlock fail");
     }
+}
+
+
+static inline void
+fmutex_init(struct fmutex *mutex)
+{
+    atomic_init(&mutex->value, 0);
     mutex->where = NULL;
 }
 
+static inline void
+fmutex_destroy(struct fmutex *mutex)
+{
+    ASSERT(!atomic_load_explicit(&mutex->value, memory_order_relaxed));
+    mutex->where = NULL;
+}
+
+static inline bool
+fmutex_try_lock__(struct fmutex *mutex)
+{
+    uint32_t expected = 0;
+
+    return atomic_compare_exchange_strong_explicit(&mutex->value, &expected,
+                                                   1, memory_order_acquire,
+                                                   memory_order_relaxed);
+}
+
+/* Returns 1 iff the lock succeeded */
+static inline int
+fmutex_try_lock_at(struct fmutex *mutex, const char *where)
+{
+    if (!fmutex_try_lock__(mutex)) {
+        return 0;
+    }
+    mutex->where = where;
+    LOCK_PROFILE_ACQUIRED(mutex, where, 0);
+    return 1;
+}
+
+static inline void
+fmutex_lock_at(struct fmutex *mutex, const char *where)
+{
+    uint64_t wait_start = 0;
+
+    if (fmutex_try_lock__(mutex)) {
+        goto out;
+    }
+    LOCK_PROFILE_WAIT(wait_start);
+    for (int i = 0; i < FMUTEX_SPIN; i++) {
+        cpu_relax();
+        if (!atomic_load_explicit(&mutex->value, memory_order_relaxed) &&
+            fmutex_try_lock__(mutex)) {
+            goto out;
+        }
+    }
+    /* Mark the lock as contended. Whoever finds it free this way owns it,
+     * and must wake others on unlock since it cannot know there are none. */
+    while (atomic_exchange_explicit(&mutex->value, 2, memory_order_acquire)) {
+        futex_wait(&mutex->value, 2);
+    }
+out:
+    mutex->where = where;
+    LOCK_PROFILE_ACQUIRED(mutex, where, wait_start);
+}
 
 static inline void
-cond_init(struct cond *cond) {
-    if (pthread_cond_init(&cond->cond, NULL)) {
-        abort_msg("pthread_cond_init fail");
+fmutex_unlock(struct fmutex *mutex)
+{
+    ASSERT(atomic_load_explicit(&mutex->value, memory_order_relaxed));
+    LOCK_PROFILE_RELEASED(mutex, mutex->where);
+    mutex->where = NULL;
+    if (atomic_exchange_explicit(&mutex->value, 0, memory_order_release)
+        == 2) {
+        futex_wake(&mutex->value, 1);
     }
-    mutex_init(&cond->mutex);
-#ifndef __cplusplus
+}
+
+static inline void
+cond_init(struct cond *cond)
+{
     atomic_init(&cond->value, 0);
-#else
-    cond->value.store(0, std::memory_order_release);
-#endif
 }
 
 static inline void
-cond_destroy(struct cond *cond) {
-#ifndef __cplusplus
-    uint32_t value = atomic_load(&cond->value);
-#else
-    uint32_t value = cond->value.load(std::memory_order_acquire);
-#endif
-    ASSERT(!value);
-    if (pthread_cond_destroy(&cond->cond)) {
-        abort_msg("pthread_cond_destroy fail");
-    }
-    mutex_destroy(&cond->mutex);
+cond_destroy(struct cond *cond)
+{
+    ASSERT(!atomic_load_explicit(&cond->value, memory_order_relaxed));
 }
 
+/* Waits until "cond" is unlocked */
 static inline void
-cond_wait_at(struct cond *cond, const char *where) {
+cond_wait_at(struct cond *cond, const char *where)
+{
     uint32_t value;
-    mutex_lock_at(&cond->mutex, where);
-    while (1) {
-#ifndef __cplusplus
-        value = atomic_load(&cond->value);
-#else
-        value = cond->value.load(std::memory_order_acquire);
-#endif
-        if (!value) {
-            break;
+
+    (void)where;
+    for (int i = 0; i < COND_SPIN; i++) {
+        if (!atomic_load_explicit(&cond->value, memory_order_acquire)) {
+            return;
         }
-        if (pthread_cond_wait(&cond->cond, &cond->mutex.lock)) {
-            abort_msg("pthread_cond_wait fail");
+        cpu_relax();
+    }
+    while ((value = atomic_load_explicit(&cond->value,
+                                         memory_order_acquire))) {
+        /* Announce a waiter, so "cond_unlock" issues a wake */
+        if (value == 1 &&
+            !atomic_compare_exchange_strong_explicit(&cond->value, &value, 2,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed)) {
+            continue;
         }
+        futex_wait(&cond->value, 2);
     }
-    mutex_unlock(&cond->mutex);
 }
 
+/* Locks "cond", so that threads calling "cond_wait" block. Has no effect if
+ * "cond" is already locked. */
 static inline void
-cond_lock_at(struct cond *cond, const char *where) {
-#ifndef __cplusplus
-    atomic_store(&cond->value, 1);
-#else
-    cond->value.store(1, std::memory_order_release);
-#endif
+cond_lock_at(struct cond *cond, const char *where)
+{
+    uint32_t expected = 0;
+
+    (void)where;
+    atomic_compare_exchange_strong_explicit(&cond->value, &expected, 1,
+                                            memory_order_release,
+                                            memory_order_relaxed);
 }
 
 static inline bool
 cond_is_locked(struct cond *cond)
 {
-#ifndef __cplusplus
-    uint32_t value = atomic_load(&cond->value);
-#else
-    uint32_t value = cond->value.load(std::memory_order_acquire);
-#endif
-    return value==1;
+    return atomic_load_explicit(&cond->value, memory_order_acquire) != 0;
 }
 
+/* Unlocks "cond" and wakes all threads waiting on it */
 static inline void
-cond_unlock(struct cond *cond) {
-    mutex_lock(&cond->mutex);
-#ifndef __cplusplus
-    atomic_store(&cond->value, 0);
-#else
-    cond->value.store(0, std::memory_order_release);
-#endif
-    if (pthread_cond_broadcast(&cond->cond)) {
-        abort_msg("pthread_cond_broadcast fail");
+cond_unlock(struct cond *cond)
+{
+    if (atomic_exchange_explicit(&cond->value, 0, memory_order_release)
+        == 2) {
+        futex_wake(&cond->value, FUTEX_WAKE_ALL);
     }
-    mutex_unlock(&cond->mutex);
 }
 
-
-
 #endif
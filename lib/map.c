@@ -87,6 +87,15 @@ void
 map_init(struct map *map, size_t size)
 {
     map->impl = map_impl_init(size);
+    map->keyed = false;
+}
+
+void
+map_init_keyed(struct map *map, size_t size)
+{
+    map_init(map, size);
+    hash_key_init_random(&map->key);
+    map->keyed = true;
 }
 
 void
@@ -122,7 +131,7 @@ map_is_empty(const struct map *map)
 }
 
 size_t
-map_insert(struct map *map, struct map_node *node, uint32_t hash)
+map_insert(struct map *map, struct map_node *node, map_hash_t hash)
 {
     struct map_impl *impl;
     size_t count;
@@ -166,8 +175,20 @@ map_remove(struct map *map, struct map_node *node)
     return count;
 }
 
+#ifdef MAP_HASH64
+/* Returns "node" or the first node after it with "hash" */
+static inline struct map_node *
+map_skip__(struct map_node *node, map_hash_t hash)
+{
+    while (node && node->hash != hash) {
+        node = node->next;
+    }
+    return node;
+}
+#endif
+
 struct map_cursor
-map_find__(struct map *map, uint32_t hash)
+map_find__(struct map *map, map_hash_t hash)
 {
     struct map_impl *impl;
     struct map_cursor cursor;
@@ -177,6 +198,10 @@ map_find__(struct map *map, uint32_t hash)
     cursor.node = impl->arr[cursor.entry_idx].first;
     cursor.next = NULL;
     cursor.accross_entries = false;
+#ifdef MAP_HASH64
+    cursor.hash = hash;
+    cursor.node = map_skip__(cursor.node, hash);
+#endif
     if (cursor.node) {
         cursor.next = cursor.node->next;
     }
@@ -188,6 +213,11 @@ map_start__(struct map *map)
 {
     struct map_cursor cursor = map_find__(map, 0);
     cursor.accross_entries = true;
+#ifdef MAP_HASH64
+    /* Visit all nodes of the first entry, not only those with hash 0 */
+    cursor.node = NULL;
+    cursor.next = map_impl_get(map)->arr[0].first;
+#endif
     /* Don't start with an empty node */
     if (!cursor.node) {
         map_next__(map, &cursor);
@@ -202,6 +232,11 @@ map_next__(struct map *map, struct map_cursor *cursor)
     impl = map_impl_get(map);
 
     cursor->node = cursor->next;
+#ifdef MAP_HASH64
+    if (!cursor->accross_entries) {
+        cursor->node = map_skip__(cursor->node, cursor->hash);
+    }
+#endif
     if (cursor->node) {
         cursor->next = cursor->node->next;
         return;
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "util.h"
+#include "hash.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -14,7 +15,7 @@ extern "C" {
 
 struct map_node {
     struct map_node *next; /* Next node with same hash. */
-    uint32_t hash;
+    map_hash_t hash;
 };
 
 /* Used for going over all map nodes */
@@ -23,35 +24,74 @@ struct map_cursor {
     struct map_node *next; /* Pointer to map_node */
     size_t entry_idx;      /* Current entry */
     bool accross_entries;  /* Hold cursor accross map entries */
+#ifdef MAP_HASH64
+    map_hash_t hash;       /* Only nodes with this hash, unless accross */
+#endif
 };
 
 /* Concurrent hash map. */
 struct map {
     struct map_impl *impl;
+    struct hash_key key;   /* Secret of "map_hash_*", if "keyed" */
+    bool keyed;
 };
 
-/* Initialization of "map". "size" shoule be a power of 2 */
+/* Initialization of "map". "size" shoule be a power of 2. "map_init_keyed"
+ * draws a random secret for the "map_hash_*" functions, for tables whose
+ * keys come from untrusted sources. */
 void map_init(struct map *map, size_t size);
+void map_init_keyed(struct map *map, size_t size);
 void map_destroy(struct map *);
 
+/* Hashes a key for insertion or lookup: with SipHash under the secret of a
+ * keyed map, or with the default hash otherwise. */
+static inline map_hash_t
+map_hash_bytes(const struct map *map, const void *p, size_t n)
+{
+    if (map->keyed) {
+        return hash_siphash(p, n, &map->key);
+    }
+#ifdef MAP_HASH64
+    return hash64_bytes(p, n, 0);
+#else
+    return hash_bytes(p, n, 0);
+#endif
+}
+
+static inline map_hash_t
+map_hash_uint64(const struct map *map, uint64_t x)
+{
+    if (map->keyed) {
+        return hash_siphash_uint64(x, &map->key);
+    }
+#ifdef MAP_HASH64
+    return hash64_uint64(x, 0);
+#else
+    return hash_uint64(x);
+#endif
+}
+
 /* Counters. */
 size_t map_size(const struct map *);
 bool map_is_empty(const struct map *);
 double map_utilization(const struct map *map);
 
 /* Insertion and deletion. Return the current count after the operation. */
-size_t map_insert(struct map *, struct map_node *, uint32_t hash);
+size_t map_insert(struct map *, struct map_node *, map_hash_t hash);
 size_t map_remove(struct map *, struct map_node *);
 
 #define MAP_FOR_EACH(NODE, MEMBER, STATE) \
     MAP_FOR_EACH__(NODE, MEMBER, MAP, map_start__(STATE), STATE)
 
+/* Visits the nodes in the bucket of "HASH". With MAP_HASH64, skips nodes
+ * whose hash differs, so the bits above the bucket index act as a tag that
+ * rejects most collisions before the caller compares keys. */
 #define MAP_FOR_EACH_WITH_HASH(NODE, MEMBER, HASH, STATE) \
     MAP_FOR_EACH__(NODE, MEMBER, MAP, map_find__(STATE, HASH), STATE)
 
 /* Ieration, private methods. Use iteration macros instead */
 struct map_cursor map_start__(struct map *state);
-struct map_cursor map_find__(struct map *state, uint32_t hash);
+struct map_cursor map_find__(struct map *state, map_hash_t hash);
 void map_next__(struct map *state, struct map_cursor *cursor);
 
 #define MAP_FOR_EACH__(NODE, MEMBER, MAP, START, STATE)                 \
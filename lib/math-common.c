@@ -9,25 +9,33 @@
 int
 compare_floats(const void *a, const void *b)
 {
-    return *(float*)a >= *(float*)b;
+    float x = *(const float*)a;
+    float y = *(const float*)b;
+    return (x > y) - (x < y);
 }
 
 int
 compare_integers(const void *a, const void *b)
 {
-    return *(int*)a >= *(int*)b;
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
 }
 
 int
 compare_uint32(const void *a, const void *b)
 {
-    return *(uint32_t*)a >= *(uint32_t*)b;
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
 }
 
 int
 compare_uint64(const void *a, const void *b)
 {
-    return *(uint64_t*)a >= *(uint64_t*)b;
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
 }
 
 double
@@ -11,6 +11,8 @@
 extern "C" {
 #endif
 
+/* Three-way comparators for qsort. For large arrays of plain keys, prefer
+ * the radix sorts in "sort.h". */
 int compare_floats(const void *a, const void *b);
 int compare_integers(const void *a, const void *b);
 int compare_uint64(const void *a, const void *b);
@@ -0,0 +1,38 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "util.h"
+#include "mpmc-queue.h"
+
+void
+mpmc_queue_init(struct mpmc_queue *queue, size_t size)
+{
+    if (!IS_POW2(size)) {
+        abort_msg("mpmc_queue_init: size must be a power of 2");
+    }
+    queue->cells = xmalloc_cacheline(sizeof(*queue->cells) * size);
+    queue->mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&queue->cells[i].seq, i);
+        queue->cells[i].data = NULL;
+    }
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+}
+
+void
+mpmc_queue_destroy(struct mpmc_queue *queue)
+{
+    if (!queue) {
+        return;
+    }
+    free_cacheline(queue->cells);
+    queue->cells = NULL;
+}
+
+size_t
+mpmc_queue_size(struct mpmc_queue *queue)
+{
+    size_t head = atomic_load(&queue->head);
+    size_t tail = atomic_load(&queue->tail);
+    return tail > head ? tail - head : 0;
+}
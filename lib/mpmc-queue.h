@@ -0,0 +1,168 @@
+#ifndef _MPMC_QUEUE_H
+#define _MPMC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bounded lock-free queue of pointers. Supports several concurrent producers
+ * and several concurrent consumers. Each slot holds a sequence number that
+ * tells producers and consumers whether it is free or full for the current
+ * lap, so producers and consumers only contend on their own index.
+ * Based on Dmitry Vyukov's bounded MPMC queue. */
+
+struct mpmc_queue_cell {
+    atomic_size_t seq;
+    void *data;
+};
+
+struct mpmc_queue {
+    PADDED_MEMBERS(CACHE_LINE_SIZE,
+        struct mpmc_queue_cell *cells;
+        size_t mask;
+    );
+    /* Producers and consumers index, on separate cache lines */
+    PADDED_MEMBERS(CACHE_LINE_SIZE, atomic_size_t tail;);
+    PADDED_MEMBERS(CACHE_LINE_SIZE, atomic_size_t head;);
+};
+
+/* Initiates "queue" with "size" slots. "size" must be a power of 2 */
+void mpmc_queue_init(struct mpmc_queue *queue, size_t size);
+void mpmc_queue_destroy(struct mpmc_queue *queue);
+
+/* Returns the approximate number of elements in "queue" */
+size_t mpmc_queue_size(struct mpmc_queue *queue);
+
+static inline bool mpmc_queue_enqueue(struct mpmc_queue *, void *data);
+static inline bool mpmc_queue_dequeue(struct mpmc_queue *, void **data);
+static inline size_t mpmc_queue_enqueue_batch(struct mpmc_queue *,
+                                              void **data, size_t n);
+static inline size_t mpmc_queue_dequeue_batch(struct mpmc_queue *,
+                                              void **data, size_t n);
+
+/* Inserts "data" into "queue". Returns false iff "queue" is full. */
+static inline bool
+mpmc_queue_enqueue(struct mpmc_queue *queue, void *data)
+{
+    return mpmc_queue_enqueue_batch(queue, &data, 1);
+}
+
+/* Removes the oldest element in "queue" into "data". Returns false iff
+ * "queue" is empty. */
+static inline bool
+mpmc_queue_dequeue(struct mpmc_queue *queue, void **data)
+{
+    return mpmc_queue_dequeue_batch(queue, data, 1);
+}
+
+/* Counts the consecutive cells starting at "pos" (up to "n") whose sequence
+ * number equals their position plus "offset". Sets "diff" to the sequence
+ * difference of the first cell that does not match. */
+static inline size_t
+mpmc_queue_scan__(struct mpmc_queue *queue, size_t pos, size_t n,
+                  size_t offset, intptr_t *diff)
+{
+    struct mpmc_queue_cell *cell;
+    size_t seq;
+    size_t k;
+
+    *diff = 0;
+    for (k = 0; k < n; k++) {
+        cell = &queue->cells[(pos + k) & queue->mask];
+        seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        *diff = (intptr_t)seq - (intptr_t)(pos + k + offset);
+        if (*diff) {
+            break;
+        }
+    }
+    return k;
+}
+
+/* Inserts up to "n" elements of "data" into "queue" in order, claiming all
+ * slots with a single atomic operation. Returns the number of elements
+ * inserted, which is less than "n" only when "queue" is full. */
+static inline size_t
+mpmc_queue_enqueue_batch(struct mpmc_queue *queue, void **data, size_t n)
+{
+    struct mpmc_queue_cell *cell;
+    intptr_t diff;
+    size_t pos;
+    size_t k;
+
+    pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    while (1) {
+        k = mpmc_queue_scan__(queue, pos, n, 0, &diff);
+        if (k) {
+            /* Free cells cannot be claimed by others while "tail" is
+             * still "pos" */
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos,
+                                                      pos + k,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* The cell still holds an element from the previous lap */
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+
+    for (size_t i = 0; i < k; i++) {
+        cell = &queue->cells[(pos + i) & queue->mask];
+        cell->data = data[i];
+        atomic_store_explicit(&cell->seq, pos + i + 1, memory_order_release);
+    }
+    return k;
+}
+
+/* Removes up to "n" of the oldest elements in "queue" into "data", claiming
+ * all slots with a single atomic operation. Returns the number of elements
+ * removed, which is less than "n" only when "queue" ran out of elements. */
+static inline size_t
+mpmc_queue_dequeue_batch(struct mpmc_queue *queue, void **data, size_t n)
+{
+    struct mpmc_queue_cell *cell;
+    intptr_t diff;
+    size_t pos;
+    size_t k;
+
+    pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    while (1) {
+        k = mpmc_queue_scan__(queue, pos, n, 1, &diff);
+        if (k) {
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &pos,
+                                                      pos + k,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* The cell was not written yet in this lap */
+            return 0;
+        } else {
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+
+    for (size_t i = 0; i < k; i++) {
+        cell = &queue->cells[(pos + i) & queue->mask];
+        data[i] = cell->data;
+        atomic_store_explicit(&cell->seq, pos + i + queue->mask + 1,
+                              memory_order_release);
+    }
+    return k;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef _MPSC_QUEUE_H
+#define _MPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Intrusive lock-free queue with many producers and a single consumer,
+ * based on Dmitry Vyukov's intrusive MPSC queue. Nodes are embedded in the
+ * user's objects like "struct list", so pushing never allocates. Pushing is
+ * wait-free: a single atomic exchange followed by a store.
+ *
+ * Usage example:
+ *
+ * struct {
+ *     struct mpsc_queue_node node;
+ *     int value;
+ * } *data;
+ * struct mpsc_queue_batch batch = mpsc_queue_pop_all(&queue);
+ * MPSC_QUEUE_BATCH_FOR_EACH (data, node, &batch) {
+ *      ...
+ * }
+ */
+
+struct mpsc_queue_node {
+    _Atomic(struct mpsc_queue_node *) next;
+};
+
+struct mpsc_queue {
+    /* Written by producers */
+    PADDED_MEMBERS(CACHE_LINE_SIZE,
+        _Atomic(struct mpsc_queue_node *) tail;
+    );
+    /* Owned by the consumer. The queue always holds a stub node, so
+     * producers never see an empty queue. Two stubs alternate, as a stub
+     * may still be linked in a detached batch. */
+    PADDED_MEMBERS(CACHE_LINE_SIZE,
+        struct mpsc_queue_node *head;
+        struct mpsc_queue_node *stub;
+        struct mpsc_queue_node stubs[2];
+    );
+};
+
+/* Nodes detached by "mpsc_queue_pop_all" */
+struct mpsc_queue_batch {
+    struct mpsc_queue_node *first;
+    struct mpsc_queue_node *last;
+    struct mpsc_queue_node *stub;  /* Skipped while iterating */
+};
+
+static inline void mpsc_queue_init(struct mpsc_queue *);
+static inline void mpsc_queue_push(struct mpsc_queue *,
+                                   struct mpsc_queue_node *);
+static inline struct mpsc_queue_node *mpsc_queue_pop(struct mpsc_queue *);
+static inline struct mpsc_queue_batch mpsc_queue_pop_all(struct mpsc_queue *);
+static inline struct mpsc_queue_node *
+mpsc_queue_batch_pop(struct mpsc_queue_batch *);
+
+/* Iterate and pop all nodes in BATCH. ITER may be freed in the loop body */
+#define MPSC_QUEUE_BATCH_FOR_EACH(ITER, MEMBER, BATCH)                  \
+    for (struct mpsc_queue_node *node__;                                \
+         (node__ = mpsc_queue_batch_pop(BATCH)) != NULL                 \
+         && (INIT_CONTAINER(ITER, node__, MEMBER), 1);)
+
+static inline void
+mpsc_queue_init(struct mpsc_queue *queue)
+{
+    atomic_init(&queue->stubs[0].next, NULL);
+    atomic_init(&queue->stubs[1].next, NULL);
+    queue->stub = &queue->stubs[0];
+    queue->head = queue->stub;
+    atomic_init(&queue->tail, queue->stub);
+}
+
+/* Inserts "node" into "queue". Thread safe. */
+static inline void
+mpsc_queue_push(struct mpsc_queue *queue, struct mpsc_queue_node *node)
+{
+    struct mpsc_queue_node *prev;
+
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    prev = atomic_exchange_explicit(&queue->tail, node, memory_order_acq_rel);
+    /* Until this store, consumers cannot reach "node" */
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+/* Consumer only. Removes and returns the oldest node in "queue", or NULL if
+ * "queue" is empty. Also returns NULL when the oldest node is being pushed
+ * concurrently and is not linked yet; try again later in this case. */
+static inline struct mpsc_queue_node *
+mpsc_queue_pop(struct mpsc_queue *queue)
+{
+    struct mpsc_queue_node *head = queue->head;
+    struct mpsc_queue_node *next;
+
+    next = atomic_load_explicit(&head->next, memory_order_acquire);
+    if (head == queue->stub) {
+        if (!next) {
+            return NULL;
+        }
+        queue->head = head = next;
+        next = atomic_load_explicit(&head->next, memory_order_acquire);
+    }
+    if (next) {
+        queue->head = next;
+        return head;
+    }
+
+    /* "head" is the last linked node. If it is also the tail, push the stub
+     * behind it so it can be detached. */
+    if (head != atomic_load_explicit(&queue->tail, memory_order_acquire)) {
+        return NULL;
+    }
+    mpsc_queue_push(queue, queue->stub);
+    next = atomic_load_explicit(&head->next, memory_order_acquire);
+    if (next) {
+        queue->head = next;
+        return head;
+    }
+    return NULL;
+}
+
+/* Consumer only. Detaches all nodes in "queue" with a single atomic exchange
+ * and returns them in FIFO order. Pop nodes from the result using
+ * "mpsc_queue_batch_pop" or "MPSC_QUEUE_BATCH_FOR_EACH". The batch must be
+ * consumed before the next call to this. */
+static inline struct mpsc_queue_batch
+mpsc_queue_pop_all(struct mpsc_queue *queue)
+{
+    struct mpsc_queue_batch batch = { NULL, NULL, queue->stub };
+    struct mpsc_queue_node *head = queue->head;
+    struct mpsc_queue_node *stub;
+
+    if (head == queue->stub) {
+        head = atomic_load_explicit(&head->next, memory_order_acquire);
+        if (!head) {
+            return batch;
+        }
+    }
+
+    /* The current stub may still be linked in the batch, switch stubs */
+    stub = (queue->stub == &queue->stubs[0]) ? &queue->stubs[1]
+                                             : &queue->stubs[0];
+    atomic_store_explicit(&stub->next, NULL, memory_order_relaxed);
+    batch.last = atomic_exchange_explicit(&queue->tail, stub,
+                                          memory_order_acq_rel);
+    batch.first = head;
+    queue->stub = stub;
+    queue->head = stub;
+    return batch;
+}
+
+/* Removes and returns the first node of "batch", or NULL if it is empty.
+ * Nodes of producers that were preempted mid-push are waited for. */
+static inline struct mpsc_queue_node *
+mpsc_queue_batch_pop(struct mpsc_queue_batch *batch)
+{
+    struct mpsc_queue_node *node;
+    struct mpsc_queue_node *next;
+
+    while (batch->first) {
+        node = batch->first;
+        if (node == batch->last) {
+            batch->first = NULL;
+        } else {
+            do {
+                next = atomic_load_explicit(&node->next,
+                                            memory_order_acquire);
+            } while (!next);
+            batch->first = next;
+        }
+        if (node != batch->stub) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
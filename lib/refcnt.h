@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 #include <stdatomic.h>
+#include <stdbool.h>
+#include "util.h"
 
 struct refcnt {
     atomic_uint val;
@@ -50,4 +52,75 @@ refcnt_set(struct refcnt *refcnt, uint32_t val)
     atomic_store(&refcnt->val, val);
 }
 
+/* Biased reference count. The thread that initializes it becomes its owner,
+ * and takes and drops references on a private counter without atomic
+ * read-modify-write operations; other threads use a shared atomic counter.
+ * When the owner drops its last reference, it merges its counter into the
+ * shared one and gives up ownership, so from then on every thread uses the
+ * shared counter.
+ *
+ * References taken by the owner (including the initial one) must be dropped
+ * by the owner. References taken by other threads may be dropped by any
+ * thread other than the owner. */
+struct brefcnt {
+    atomic_uint owner;      /* "thread_id" + 1 of the owner, 0 once merged */
+    uint32_t local;         /* References of the owner */
+    atomic_uint shared;     /* Other references << 1 | BREFCNT_MERGED */
+};
+
+#define BREFCNT_MERGED 1u
+#define BREFCNT_ONE 2u
+
+static inline bool
+brefcnt_is_owner__(const struct brefcnt *refcnt)
+{
+    return atomic_load_explicit(&refcnt->owner, memory_order_relaxed) ==
+           thread_id() + 1;
+}
+
+static inline void
+brefcnt_init(struct brefcnt *refcnt)
+{
+    atomic_init(&refcnt->owner, thread_id() + 1);
+    refcnt->local = 1;
+    atomic_init(&refcnt->shared, 0);
+}
+
+static inline void
+brefcnt_destroy(struct brefcnt *refcnt)
+{
+    ASSERT(atomic_load(&refcnt->shared) == BREFCNT_MERGED);
+}
+
+static inline void
+brefcnt_ref(struct brefcnt *refcnt)
+{
+    if (brefcnt_is_owner__(refcnt)) {
+        refcnt->local++;
+    } else {
+        atomic_fetch_add(&refcnt->shared, BREFCNT_ONE);
+    }
+}
+
+/* Returns true if this dropped the last reference */
+static inline bool
+brefcnt_unref(struct brefcnt *refcnt)
+{
+    uint32_t old;
+
+    if (brefcnt_is_owner__(refcnt)) {
+        ASSERT(refcnt->local != 0);
+        if (--refcnt->local) {
+            return false;
+        }
+        atomic_store_explicit(&refcnt->owner, 0, memory_order_relaxed);
+        old = atomic_fetch_or(&refcnt->shared, BREFCNT_MERGED);
+        return old == 0;
+    }
+
+    old = atomic_fetch_sub(&refcnt->shared, BREFCNT_ONE);
+    ASSERT(old >= BREFCNT_ONE);
+    return old == (BREFCNT_ONE | BREFCNT_MERGED);
+}
+
 #endif
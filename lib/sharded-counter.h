@@ -0,0 +1,104 @@
+#ifndef _SHARDED_COUNTER_H
+#define _SHARDED_COUNTER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A statistics counter that many threads update often and few threads read.
+ * Each update adds to the cache-line sized shard of the CPU it runs on with
+ * a relaxed atomic, so updates on different cores do not bounce a shared
+ * line, unless there are fewer shards than CPUs; reading sums all shards.
+ * A read that runs concurrently with updates returns a value the counter
+ * had at some point during the read, or close to it, which is what
+ * statistics need. Use a plain atomic where exact reads matter. */
+
+ALIGNED_STRUCT(CACHE_LINE_SIZE, sharded_counter_shard) {
+    atomic_long value;
+};
+
+struct sharded_counter {
+    struct sharded_counter_shard *shards;
+    unsigned int mask;
+};
+
+/* "shards" is rounded up to a power of 2. Set to 0 for one shard per
+ * configured CPU. */
+static inline void
+sharded_counter_init(struct sharded_counter *c, unsigned int shards)
+{
+    unsigned int size = 1;
+
+    if (!shards) {
+        long cpus = sysconf(_SC_NPROCESSORS_CONF);
+        shards = cpus > 0 ? cpus : 1;
+    }
+    while (size < shards) {
+        size <<= 1;
+    }
+
+    c->shards = (struct sharded_counter_shard *)
+                xmalloc_cacheline(sizeof(*c->shards) * size);
+    c->mask = size - 1;
+    for (unsigned int i = 0; i < size; i++) {
+        atomic_init(&c->shards[i].value, 0);
+    }
+}
+
+static inline void
+sharded_counter_destroy(struct sharded_counter *c)
+{
+    free_cacheline(c->shards);
+    c->shards = NULL;
+}
+
+static inline void
+sharded_counter_add(struct sharded_counter *c, long delta)
+{
+    struct sharded_counter_shard *shard = &c->shards[current_cpu() & c->mask];
+    atomic_fetch_add_explicit(&shard->value, delta, memory_order_relaxed);
+}
+
+static inline void
+sharded_counter_inc(struct sharded_counter *c)
+{
+    sharded_counter_add(c, 1);
+}
+
+static inline void
+sharded_counter_dec(struct sharded_counter *c)
+{
+    sharded_counter_add(c, -1);
+}
+
+/* Returns the sum of all shards */
+static inline long
+sharded_counter_read(const struct sharded_counter *c)
+{
+    long sum = 0;
+    for (unsigned int i = 0; i <= c->mask; i++) {
+        sum += atomic_load_explicit(&c->shards[i].value,
+                                    memory_order_relaxed);
+    }
+    return sum;
+}
+
+/* Not exact while other threads update the counter */
+static inline void
+sharded_counter_reset(struct sharded_counter *c)
+{
+    for (unsigned int i = 0; i <= c->mask; i++) {
+        atomic_store_explicit(&c->shards[i].value, 0, memory_order_relaxed);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
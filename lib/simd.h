@@ -147,8 +147,10 @@ typedef union {
 # define SIMD_LOADU_SI(a) _mm512_loadu_si512(a)
 # elif __AVX__
 # define SIMD_LOADU_SI(a) _mm256_lddqu_si256((const __m256i*)(a))
-# elif __SSE__
+# elif __SSE3__
 # define SIMD_LOADU_SI(a) _mm_lddqu_si128((const __m128i*)(a))
+# elif __SSE__
+# define SIMD_LOADU_SI(a) _mm_loadu_si128((const __m128i*)(a))
 # endif
 # define SIMD_LOADU_SI64(a) SIMD_LOADU_SI(a)
 #endif
@@ -169,6 +171,17 @@ typedef union {
 # define SIMD_STORE_SI(a,b) SIMD_COMMAND_SUFFIX(_store_si)((EPU_REG*)(a),b)
 #endif
 
+/**
+ * @brief For clean code of unaligned integer store.
+ * @param a memory location
+ * @param b vector register
+ */
+#ifdef NSIMD
+# define SIMD_STOREU_SI(a,b) *(__typeof__(b)*)a = b
+#elif __SSE__
+# define SIMD_STOREU_SI(a,b) SIMD_COMMAND_SUFFIX(_storeu_si)((EPU_REG*)(a),b)
+#endif
+
 /**
  * @brief For clean code of set1.
  * @param a float value
@@ -522,6 +535,50 @@ __simd_add_epi32(__m256i a, __m256i b)
 # define SIMD_MUL_EPI32(a,b) SIMD_COMMAND(_mul_epi32(a, b))
 #endif
 
+/**
+ * @brief For clean code of multiply, keeps the low 32 bits of each product
+ * (unlike SIMD_MUL_EPI32, which widens the even elements).
+ * @param a vector register
+ * @param b vector register
+ */
+#ifdef NSIMD
+# define SIMD_MULLO_EPI32(a,b) ((a)*(b))
+#elif __AVX512F__
+# define SIMD_MULLO_EPI32(a,b) _mm512_mullo_epi32(a, b)
+#elif __AVX2__
+# define SIMD_MULLO_EPI32(a,b) _mm256_mullo_epi32(a, b)
+#elif __AVX__
+
+static inline __m256i
+__simd_mullo_epi32(__m256i a, __m256i b)
+{
+    __m256i out;
+    __SIMD_SPLIT_SI(a);
+    __SIMD_SPLIT_SI(b);
+    b_lo = _mm_mullo_epi32(a_lo, b_lo);
+    b_hi = _mm_mullo_epi32(a_hi, b_hi);
+    __SIMD_MERGE_SI(b, out);
+    return out;
+}
+
+# define SIMD_MULLO_EPI32(a,b) __simd_mullo_epi32(a, b)
+#elif __SSE4_1__
+# define SIMD_MULLO_EPI32(a,b) _mm_mullo_epi32(a, b)
+#elif __SSE__
+
+/* SSE2 only multiplies the even elements into 64 bits */
+static inline __m128i
+__simd_mullo_epi32(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+}
+
+# define SIMD_MULLO_EPI32(a,b) __simd_mullo_epi32(a, b)
+#endif
+
 /**
  * @brief For clean code of sqrt.
  * @param a vector register
@@ -534,7 +591,7 @@ __simd_add_epi32(__m256i a, __m256i b)
 #endif
 
 /**
- * @brief For clean code of and/or/and-not (~a&b)
+ * @brief For clean code of and/or/and-not (~a&b)/xor
  * @param a vector register
  * @param b vector register
  */
@@ -569,6 +626,7 @@ simd_helper_andnot_ps__(float a, float b)
 # define SIMD_OR_SI(a,b) (a|b)
 # define SIMD_ANDNOT_PS(a,b) simd_helper_andnot_ps__(a, b)
 # define SIMD_ANDNOT_SI(a,b) (~a&b)
+# define SIMD_XOR_SI(a,b) (a^b)
 #elif __ARM_NEON
 # define SIMD_AND_PS(a,b)                                      \
     vreinterpretq_f32_s32(vandq_s32(vreinterpretq_s32_f32(a),  \
@@ -586,6 +644,9 @@ simd_helper_andnot_ps__(float a, float b)
 # define SIMD_ANDNOT_SI(a,b) _mm256_castps_si256(                       \
                                 _mm256_andnot_ps(_mm256_castsi256_ps(a),\
                                               _mm256_castsi256_ps(b)))
+# define SIMD_XOR_SI(a,b) _mm256_castps_si256(                       \
+                                _mm256_xor_ps(_mm256_castsi256_ps(a),\
+                                              _mm256_castsi256_ps(b)))
 
 #elif __SSE__
 # define SIMD_AND_PS(a,b) SIMD_COMMAND(_and_ps(a, b))
@@ -594,6 +655,7 @@ simd_helper_andnot_ps__(float a, float b)
 # define SIMD_OR_SI(a,b) SIMD_COMMAND_SUFFIX(_or_si)(a, b)
 # define SIMD_ANDNOT_PS(a,b) SIMD_COMMAND(_andnot_ps(a, b))
 # define SIMD_ANDNOT_SI(a,b) SIMD_COMMAND_SUFFIX(_andnot_si)(a, b)
+# define SIMD_XOR_SI(a,b) SIMD_COMMAND_SUFFIX(_xor_si)(a, b)
 #endif
 
 /**
@@ -0,0 +1,310 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "sort.h"
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_MASK (RADIX_BUCKETS - 1)
+
+/* Shared state of a (possibly multithreaded) radix sort */
+struct radix_sort {
+    char *keys[2];      /* Input keys, temporary keys */
+    char *values[2];    /* Input values, temporary values (or NULLs) */
+    size_t value_size;
+    size_t n;
+    int key_size;       /* 4 or 8 bytes */
+    bool is_float;
+    int threads;
+    size_t (*counts)[RADIX_BUCKETS]; /* Histogram per thread */
+    pthread_barrier_t barrier;
+};
+
+struct radix_worker {
+    struct radix_sort *sort;
+    int id;
+};
+
+static inline void
+radix_barrier(struct radix_sort *sort)
+{
+    if (sort->threads > 1) {
+        pthread_barrier_wait(&sort->barrier);
+    }
+}
+
+static inline void
+radix_copy_value(char *dst, const char *src, size_t size)
+{
+    switch (size) {
+    case 4:
+        *(uint32_t*)dst = *(const uint32_t*)src;
+        break;
+    case 8:
+        *(uint64_t*)dst = *(const uint64_t*)src;
+        break;
+    default:
+        memcpy(dst, src, size);
+    }
+}
+
+/* Define histogram and scatter methods for keys of type TYPE */
+#define RADIX_PASS_DEFINE(NAME, TYPE)                                        \
+static void                                                                  \
+radix_count_##NAME(const TYPE *keys, size_t lo, size_t hi, int shift,        \
+                   size_t *counts)                                           \
+{                                                                            \
+    memset(counts, 0, sizeof(*counts) * RADIX_BUCKETS);                      \
+    for (size_t i = lo; i < hi; i++) {                                       \
+        counts[(keys[i] >> shift) & RADIX_MASK]++;                           \
+    }                                                                        \
+}                                                                            \
+                                                                             \
+static void                                                                  \
+radix_scatter_##NAME(const TYPE *src, TYPE *dst,                             \
+                     const char *src_values, char *dst_values,               \
+                     size_t value_size, size_t lo, size_t hi, int shift,     \
+                     size_t *offsets)                                        \
+{                                                                            \
+    size_t pos;                                                              \
+    if (!src_values) {                                                       \
+        for (size_t i = lo; i < hi; i++) {                                   \
+            dst[offsets[(src[i] >> shift) & RADIX_MASK]++] = src[i];         \
+        }                                                                    \
+        return;                                                              \
+    }                                                                        \
+    for (size_t i = lo; i < hi; i++) {                                       \
+        pos = offsets[(src[i] >> shift) & RADIX_MASK]++;                     \
+        dst[pos] = src[i];                                                   \
+        radix_copy_value(&dst_values[pos * value_size],                      \
+                         &src_values[i * value_size],                        \
+                         value_size);                                        \
+    }                                                                        \
+}
+
+RADIX_PASS_DEFINE(uint32, uint32_t)
+RADIX_PASS_DEFINE(uint64, uint64_t)
+
+/* Maps IEEE-754 floats to unsigned integers with the same order */
+static inline uint32_t
+radix_float_to_key(uint32_t x)
+{
+    return (x & 0x80000000) ? ~x : (x | 0x80000000);
+}
+
+static inline uint32_t
+radix_key_to_float(uint32_t x)
+{
+    return (x & 0x80000000) ? (x & 0x7fffffff) : ~x;
+}
+
+static void *
+radix_sort_worker(void *args)
+{
+    struct radix_worker *worker = (struct radix_worker*)args;
+    struct radix_sort *sort = worker->sort;
+    size_t offsets[RADIX_BUCKETS];
+    size_t totals[RADIX_BUCKETS];
+    size_t *counts;
+    size_t lo, hi;
+    uint32_t *fkeys;
+    bool skip;
+    int shift;
+    int src;
+
+    lo = sort->n * worker->id / sort->threads;
+    hi = sort->n * (worker->id + 1) / sort->threads;
+    counts = sort->counts[worker->id];
+    fkeys = (uint32_t*)sort->keys[0];
+    src = 0;
+
+    if (sort->is_float) {
+        for (size_t i = lo; i < hi; i++) {
+            fkeys[i] = radix_float_to_key(fkeys[i]);
+        }
+    }
+
+    for (int pass = 0; pass < sort->key_size; pass++) {
+        shift = pass * RADIX_BITS;
+        if (sort->key_size == 4) {
+            radix_count_uint32((uint32_t*)sort->keys[src], lo, hi, shift,
+                               counts);
+        } else {
+            radix_count_uint64((uint64_t*)sort->keys[src], lo, hi, shift,
+                               counts);
+        }
+        radix_barrier(sort);
+
+        /* This thread's output for digit "d" starts after all keys with
+         * lower digits, and after keys with digit "d" of lower threads */
+        skip = false;
+        for (int d = 0; d < RADIX_BUCKETS; d++) {
+            totals[d] = 0;
+            offsets[d] = 0;
+            for (int t = 0; t < sort->threads; t++) {
+                if (t < worker->id) {
+                    offsets[d] += sort->counts[t][d];
+                }
+                totals[d] += sort->counts[t][d];
+            }
+            skip |= (totals[d] == sort->n);
+        }
+
+        /* All keys share this digit, nothing to do */
+        if (skip) {
+            radix_barrier(sort);
+            continue;
+        }
+
+        for (size_t d = 0, sum = 0; d < RADIX_BUCKETS; d++) {
+            offsets[d] += sum;
+            sum += totals[d];
+        }
+
+        if (sort->key_size == 4) {
+            radix_scatter_uint32((uint32_t*)sort->keys[src],
+                                 (uint32_t*)sort->keys[!src],
+                                 sort->values[src], sort->values[!src],
+                                 sort->value_size, lo, hi, shift, offsets);
+        } else {
+            radix_scatter_uint64((uint64_t*)sort->keys[src],
+                                 (uint64_t*)sort->keys[!src],
+                                 sort->values[src], sort->values[!src],
+                                 sort->value_size, lo, hi, shift, offsets);
+        }
+        radix_barrier(sort);
+        src = !src;
+    }
+
+    /* Results are in the temporary buffers, copy them back */
+    if (src) {
+        memcpy(&sort->keys[0][lo * sort->key_size],
+               &sort->keys[1][lo * sort->key_size],
+               (hi - lo) * sort->key_size);
+        if (sort->values[0]) {
+            memcpy(&sort->values[0][lo * sort->value_size],
+                   &sort->values[1][lo * sort->value_size],
+                   (hi - lo) * sort->value_size);
+        }
+    }
+
+    if (sort->is_float) {
+        for (size_t i = lo; i < hi; i++) {
+            fkeys[i] = radix_key_to_float(fkeys[i]);
+        }
+    }
+    return NULL;
+}
+
+static int
+radix_sort_threads(size_t n, int threads)
+{
+    if (n < SORT_PARALLEL_THRESHOLD) {
+        return 1;
+    }
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    return MAX(threads, 1);
+}
+
+static void
+radix_sort(void *keys, int key_size, bool is_float, void *values,
+           size_t value_size, size_t n, int threads)
+{
+    struct radix_worker *workers;
+    struct radix_sort sort;
+    pthread_t *tids;
+
+    if (n < 2) {
+        return;
+    }
+
+    sort.keys[0] = (char*)keys;
+    sort.keys[1] = (char*)xmalloc(n * key_size);
+    sort.values[0] = (char*)values;
+    sort.values[1] = values ? (char*)xmalloc(n * value_size) : NULL;
+    sort.value_size = value_size;
+    sort.n = n;
+    sort.key_size = key_size;
+    sort.is_float = is_float;
+    sort.threads = threads;
+    sort.counts = xmalloc_cacheline(sizeof(*sort.counts) * threads);
+
+    workers = (struct radix_worker*)xmalloc(sizeof(*workers) * threads);
+    for (int i = 0; i < threads; i++) {
+        workers[i].sort = &sort;
+        workers[i].id = i;
+    }
+
+    if (threads == 1) {
+        radix_sort_worker(&workers[0]);
+    } else {
+        tids = (pthread_t*)xmalloc(sizeof(*tids) * threads);
+        pthread_barrier_init(&sort.barrier, NULL, threads);
+        for (int i = 1; i < threads; i++) {
+            if (pthread_create(&tids[i], NULL, radix_sort_worker,
+                               &workers[i])) {
+                abort_msg("pthread_create fail");
+            }
+        }
+        radix_sort_worker(&workers[0]);
+        for (int i = 1; i < threads; i++) {
+            pthread_join(tids[i], NULL);
+        }
+        pthread_barrier_destroy(&sort.barrier);
+        free(tids);
+    }
+
+    free(workers);
+    free_cacheline(sort.counts);
+    free(sort.keys[1]);
+    free(sort.values[1]);
+}
+
+void
+sort_uint32(uint32_t *keys, void *values, size_t value_size, size_t n)
+{
+    radix_sort(keys, sizeof(*keys), false, values, value_size, n, 1);
+}
+
+void
+sort_uint64(uint64_t *keys, void *values, size_t value_size, size_t n)
+{
+    radix_sort(keys, sizeof(*keys), false, values, value_size, n, 1);
+}
+
+void
+sort_float(float *keys, void *values, size_t value_size, size_t n)
+{
+    radix_sort(keys, sizeof(*keys), true, values, value_size, n, 1);
+}
+
+void
+sort_uint32_parallel(uint32_t *keys, void *values, size_t value_size,
+                     size_t n, int threads)
+{
+    radix_sort(keys, sizeof(*keys), false, values, value_size, n,
+               radix_sort_threads(n, threads));
+}
+
+void
+sort_uint64_parallel(uint64_t *keys, void *values, size_t value_size,
+                     size_t n, int threads)
+{
+    radix_sort(keys, sizeof(*keys), false, values, value_size, n,
+               radix_sort_threads(n, threads));
+}
+
+void
+sort_float_parallel(float *keys, void *values, size_t value_size,
+                    size_t n, int threads)
+{
+    radix_sort(keys, sizeof(*keys), true, values, value_size, n,
+               radix_sort_threads(n, threads));
+}
@@ -0,0 +1,43 @@
+#ifndef _SORT_H
+#define _SORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* LSD radix sort for integer and float keys. All methods sort "n" keys in
+ * ascending order. When "values" is not NULL, it holds "n" elements of
+ * "value_size" bytes each, which are permuted along with their keys. The
+ * sort is stable. Requires a temporary buffer of the size of the input. */
+
+/* Key types, used by sorts of structured data */
+enum sort_key_type {
+    SORT_KEY_UINT32,
+    SORT_KEY_UINT64,
+    SORT_KEY_FLOAT,
+};
+
+/* Below this number of keys, parallel sorts run on the calling thread */
+#define SORT_PARALLEL_THRESHOLD (1 << 21)
+
+void sort_uint32(uint32_t *keys, void *values, size_t value_size, size_t n);
+void sort_uint64(uint64_t *keys, void *values, size_t value_size, size_t n);
+void sort_float(float *keys, void *values, size_t value_size, size_t n);
+
+/* Same as the above, using "threads" threads. Set "threads" to 0 to use all
+ * online CPUs. */
+void sort_uint32_parallel(uint32_t *keys, void *values, size_t value_size,
+                          size_t n, int threads);
+void sort_uint64_parallel(uint64_t *keys, void *values, size_t value_size,
+                          size_t n, int threads);
+void sort_float_parallel(float *keys, void *values, size_t value_size,
+                         size_t n, int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#include "util.h"
+#include "futex.h"
+#include "spsc-ring.h"
+
+/* Number of polls of an empty ring before parking the consumer */
+#define SPSC_RING_SPIN 1024
+
+/* Values of "sleeping". Every change is an exchange, so a notification is
+ * either seen by the consumer or stays pending for its next wait. */
+#define SPSC_RING_PARKED 1
+#define SPSC_RING_NOTIFIED 2
+
+void
+spsc_ring_init(struct spsc_ring *ring, size_t size, bool blocking)
+{
+    if (!IS_POW2(size)) {
+        abort_msg("spsc_ring_init: size must be a power of 2");
+    }
+    ring->slots = xmalloc_cacheline(sizeof(*ring->slots) * size);
+    ring->mask = size - 1;
+    ring->blocking = blocking;
+    ring->head_cache = 0;
+    ring->tail_cache = 0;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->sleeping, 0);
+}
+
+void
+spsc_ring_destroy(struct spsc_ring *ring)
+{
+    if (!ring) {
+        return;
+    }
+    free_cacheline(ring->slots);
+    ring->slots = NULL;
+}
+
+void
+spsc_ring_notify(struct spsc_ring *ring)
+{
+    if (atomic_exchange(&ring->sleeping, SPSC_RING_NOTIFIED) ==
+        SPSC_RING_PARKED) {
+        futex_wake(&ring->sleeping, 1);
+    }
+}
+
+size_t
+spsc_ring_dequeue_wait(struct spsc_ring *ring, void **data, size_t n)
+{
+    size_t count;
+
+    ASSERT(ring->blocking);
+    for (int i = 0; i < SPSC_RING_SPIN; i++) {
+        count = spsc_ring_dequeue_n(ring, data, n);
+        if (count) {
+            return count;
+        }
+    }
+
+    /* Announce we are about to park, then check the ring again so that an
+     * element published meanwhile is not missed. A pending notification
+     * returns at once. */
+    if (atomic_exchange(&ring->sleeping, SPSC_RING_PARKED) ==
+        SPSC_RING_NOTIFIED) {
+        atomic_exchange(&ring->sleeping, 0);
+        return spsc_ring_dequeue_n(ring, data, n);
+    }
+    atomic_thread_fence(memory_order_seq_cst);
+    count = spsc_ring_dequeue_n(ring, data, n);
+    if (count) {
+        atomic_exchange(&ring->sleeping, 0);
+        return count;
+    }
+
+    futex_wait(&ring->sleeping, SPSC_RING_PARKED);
+    atomic_exchange(&ring->sleeping, 0);
+    return spsc_ring_dequeue_n(ring, data, n);
+}
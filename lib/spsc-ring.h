@@ -0,0 +1,148 @@
+#ifndef _SPSC_RING_H
+#define _SPSC_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Wait-free ring of pointers between exactly one producer thread and one
+ * consumer thread. Each side keeps a private copy of the other side's index
+ * and only reloads it when the copy says the ring is full (producer) or empty
+ * (consumer), so in steady state each side touches the shared index line
+ * once per burst.
+ *
+ * When initiated as blocking, the consumer may park in the kernel using
+ * "spsc_ring_dequeue_wait" while the ring is empty. This costs the producer
+ * one memory fence per burst. */
+
+struct spsc_ring {
+    PADDED_MEMBERS(CACHE_LINE_SIZE,
+        void **slots;
+        size_t mask;
+        bool blocking;
+    );
+    /* Written by the producer */
+    PADDED_MEMBERS(CACHE_LINE_SIZE,
+        atomic_size_t tail;
+        size_t head_cache;  /* Producer's copy of "head" */
+    );
+    /* Written by the consumer */
+    PADDED_MEMBERS(CACHE_LINE_SIZE,
+        atomic_size_t head;
+        size_t tail_cache;  /* Consumer's copy of "tail" */
+    );
+    /* Futex word, nonzero while the consumer is parked or a notification
+     * is pending */
+    PADDED_MEMBERS(CACHE_LINE_SIZE, atomic_uint sleeping;);
+};
+
+/* Initiates "ring" with "size" slots. "size" must be a power of 2 */
+void spsc_ring_init(struct spsc_ring *ring, size_t size, bool blocking);
+void spsc_ring_destroy(struct spsc_ring *ring);
+
+/* Consumer only. Like "spsc_ring_dequeue_n", but when "ring" is empty, spins
+ * for a while and then parks until the producer inserts elements. May return
+ * 0 after "spsc_ring_notify" or a spurious wakeup. "ring" must be blocking. */
+size_t spsc_ring_dequeue_wait(struct spsc_ring *ring, void **data, size_t n);
+
+/* Wakes the consumer if it is parked in "spsc_ring_dequeue_wait", e.g., for
+ * shutdown after setting a stop flag. If it is not parked, the notification
+ * stays pending, and its next "spsc_ring_dequeue_wait" that finds the ring
+ * empty returns instead of parking. Thread safe. */
+void spsc_ring_notify(struct spsc_ring *ring);
+
+/* Returns the number of elements in "ring". Exact only when called by the
+ * producer or the consumer. */
+static inline size_t
+spsc_ring_size(struct spsc_ring *ring)
+{
+    return atomic_load_explicit(&ring->tail, memory_order_acquire) -
+           atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+/* Producer only. Inserts up to "n" elements of "data" into "ring" and
+ * publishes them at once. Returns the number of elements inserted, which is
+ * less than "n" only when "ring" is full. */
+static inline size_t
+spsc_ring_enqueue_n(struct spsc_ring *ring, void *const *data, size_t n)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t size = ring->mask + 1;
+    size_t free = size - (tail - ring->head_cache);
+
+    if (free < n) {
+        ring->head_cache = atomic_load_explicit(&ring->head,
+                                                memory_order_acquire);
+        free = size - (tail - ring->head_cache);
+        n = MIN(n, free);
+        if (!n) {
+            return 0;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        ring->slots[(tail + i) & ring->mask] = data[i];
+    }
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+
+    if (ring->blocking) {
+        /* Pairs with the fence in "spsc_ring_dequeue_wait": either we see
+         * the consumer parked, or it sees the new tail */
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&ring->sleeping, memory_order_relaxed)) {
+            spsc_ring_notify(ring);
+        }
+    }
+    return n;
+}
+
+/* Consumer only. Removes up to "n" of the oldest elements in "ring" into
+ * "data". Returns the number of elements removed. */
+static inline size_t
+spsc_ring_dequeue_n(struct spsc_ring *ring, void **data, size_t n)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t avail = ring->tail_cache - head;
+
+    if (avail < n) {
+        ring->tail_cache = atomic_load_explicit(&ring->tail,
+                                                memory_order_acquire);
+        avail = ring->tail_cache - head;
+        n = MIN(n, avail);
+        if (!n) {
+            return 0;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        data[i] = ring->slots[(head + i) & ring->mask];
+    }
+    atomic_store_explicit(&ring->head, head + n, memory_order_release);
+    return n;
+}
+
+/* Producer only. Returns false iff "ring" is full. */
+static inline bool
+spsc_ring_enqueue(struct spsc_ring *ring, void *data)
+{
+    return spsc_ring_enqueue_n(ring, &data, 1);
+}
+
+/* Consumer only. Returns false iff "ring" is empty. */
+static inline bool
+spsc_ring_dequeue(struct spsc_ring *ring, void **data)
+{
+    return spsc_ring_dequeue_n(ring, data, 1);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
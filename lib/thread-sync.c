@@ -1,36 +1,280 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <sched.h>
+#include "futex.h"
 #include "thread-sync.h"
 
+/* Polls before a waiting thread parks */
+#define THREAD_SYNC_SPIN 4096
+
+#define ARRIVED(MEMBERS) ((uint32_t)((MEMBERS) & THREAD_SYNC_ARRIVED_MASK))
+#define WORKERS(MEMBERS) \
+    ((uint32_t)(((MEMBERS) & ~THREAD_SYNC_COMPLETE) >> 32))
+
+/* Wakes all parked threads so they recheck their condition */
+static void
+thread_sync_wake(struct thread_sync *ts)
+{
+    atomic_fetch_add(&ts->wake_seq, 1);
+    if (atomic_load(&ts->sleepers)) {
+        futex_wake(&ts->wake_seq, FUTEX_WAKE_ALL);
+    }
+}
+
+/* Returns true once the barrier of generation "id" is released, and sets
+ * "result" to the role of the caller */
+static bool
+thread_sync_released(struct thread_sync *ts, uint32_t id, int *result)
+{
+    if (atomic_load(&ts->wait_id) != id) {
+        *result = THREAD_SYNC_WAIT_WORKER;
+        return true;
+    }
+    if (atomic_load_explicit(&ts->promote, memory_order_relaxed) &&
+        atomic_exchange(&ts->promote, 0)) {
+        *result = THREAD_SYNC_WAIT_LEADER;
+        return true;
+    }
+    return false;
+}
+
+static int
+thread_sync_wait_release(struct thread_sync *ts, uint32_t id)
+{
+    uint32_t seq;
+    int result;
+
+    for (int i = 0; i < THREAD_SYNC_SPIN; i++) {
+        if (thread_sync_released(ts, id, &result)) {
+            return result;
+        }
+        cpu_relax();
+    }
+    while (1) {
+        /* Announce the sleeper before reading the sequence, so that a
+         * waker either sees us or changes the sequence we wait on */
+        atomic_fetch_add(&ts->sleepers, 1);
+        seq = atomic_load(&ts->wake_seq);
+        if (thread_sync_released(ts, id, &result)) {
+            atomic_fetch_sub(&ts->sleepers, 1);
+            return result;
+        }
+        futex_wait(&ts->wake_seq, seq);
+        atomic_fetch_sub(&ts->sleepers, 1);
+    }
+}
+
+/* Waits while a completed barrier was not continued yet */
+static void
+thread_sync_wait_open(struct thread_sync *ts)
+{
+    uint32_t seq;
+
+    for (int i = 0; i < THREAD_SYNC_SPIN; i++) {
+        if (!(atomic_load(&ts->members) & THREAD_SYNC_COMPLETE)) {
+            return;
+        }
+        cpu_relax();
+    }
+    while (1) {
+        atomic_fetch_add(&ts->sleepers, 1);
+        seq = atomic_load(&ts->wake_seq);
+        if (!(atomic_load(&ts->members) & THREAD_SYNC_COMPLETE)) {
+            atomic_fetch_sub(&ts->sleepers, 1);
+            return;
+        }
+        futex_wait(&ts->wake_seq, seq);
+        atomic_fetch_sub(&ts->sleepers, 1);
+    }
+}
+
 int
 thread_sync_full_barrier(struct thread_sync *ts)
 {
-    uint64_t retval;
-    uint64_t workers;
-    uint64_t id;
-    bool signal;
+    uint64_t members;
+    uint64_t next;
+    uint32_t id;
+
+    members = atomic_load(&ts->members);
+    while (1) {
+        if (members & THREAD_SYNC_COMPLETE) {
+            thread_sync_wait_open(ts);
+            members = atomic_load(&ts->members);
+            continue;
+        }
+        /* Read after "members" is seen open, so it is the generation of
+         * the barrier we arrive at */
+        id = atomic_load(&ts->wait_id);
+        next = members + 1;
+        if (ARRIVED(next) >= WORKERS(next)) {
+            next |= THREAD_SYNC_COMPLETE;
+        }
+        if (atomic_compare_exchange_weak(&ts->members, &members, next)) {
+            break;
+        }
+    }
 
-    signal = false;
-    id = atomic_load(&ts->wait_id);
+    /* I was the last thread to arrive! */
+    if (next & THREAD_SYNC_COMPLETE) {
+        return THREAD_SYNC_WAIT_LEADER;
+    }
+    return thread_sync_wait_release(ts, id);
+}
+
+void
+thread_sync_continue(struct thread_sync *ts)
+{
+    /* Advance the generation before opening the next barrier, so that a
+     * thread that sees it open also sees the new generation */
+    atomic_fetch_add(&ts->wait_id, 1);
+    atomic_fetch_and(&ts->members,
+                     ~(THREAD_SYNC_ARRIVED_MASK | THREAD_SYNC_COMPLETE));
+    thread_sync_wake(ts);
+}
+
+void
+thread_sync_unregister(struct thread_sync *ts)
+{
+    uint64_t members = atomic_load(&ts->members);
+    uint64_t next;
+
+    do {
+        next = members - THREAD_SYNC_WORKER;
+        if (!(next & THREAD_SYNC_COMPLETE) && ARRIVED(next) &&
+            ARRIVED(next) >= WORKERS(next)) {
+            next |= THREAD_SYNC_COMPLETE;
+        }
+    } while (!atomic_compare_exchange_weak(&ts->members, &members, next));
+
+    /* All remaining workers wait, so one of them must lead */
+    if ((next & THREAD_SYNC_COMPLETE) && !(members & THREAD_SYNC_COMPLETE)) {
+        atomic_store(&ts->promote, 1);
+        thread_sync_wake(ts);
+    }
+}
+
+/* Returns the lowest version acknowledged by all subscribers, or "version"
+ * if there are none. Call with "ts->lock" held. */
+static uint64_t
+thread_sync_min_ack(struct thread_sync *ts, uint64_t version)
+{
+    struct thread_sync_subscriber *sub;
+    uint64_t min = version;
+    uint64_t ack;
+
+    LIST_FOR_EACH (sub, node, &ts->subscribers) {
+        ack = atomic_load(&sub->ack);
+        min = MIN(min, ack);
+    }
+    return min;
+}
+
+void
+thread_sync_subscribe(struct thread_sync *ts,
+                      struct thread_sync_subscriber *sub)
+{
+    uint64_t version;
+
+    spinlock_lock(&ts->lock);
+    version = atomic_load(&ts->version);
+    atomic_init(&sub->ack, version);
+    sub->next = version + 1;
+    list_push_back(&ts->subscribers, &sub->node);
+    spinlock_unlock(&ts->lock);
+}
+
+void
+thread_sync_unsubscribe(struct thread_sync *ts,
+                        struct thread_sync_subscriber *sub)
+{
+    spinlock_lock(&ts->lock);
+    list_remove(&sub->node);
+    spinlock_unlock(&ts->lock);
+    /* Publishers may have waited for this subscriber */
+    thread_sync_ack_wake__(ts);
+}
+
+uint64_t
+thread_sync_publish(struct thread_sync *ts, uint64_t code, uint64_t args)
+{
+    struct thread_sync_event *event;
+    uint64_t version;
 
     while (1) {
-        /* Check signal ID */
-        if (atomic_load(&ts->wait_id) != id) {
+        spinlock_lock(&ts->lock);
+        version = atomic_load_explicit(&ts->version,
+                                       memory_order_relaxed) + 1;
+        /* The slot holds "version - THREAD_SYNC_RING_SIZE" */
+        if (version <= THREAD_SYNC_RING_SIZE ||
+            thread_sync_min_ack(ts, version) >=
+            version - THREAD_SYNC_RING_SIZE) {
             break;
         }
-        if (!signal) {
-            /* First time here */
-            signal = true;
-            retval = atomic_fetch_add(&ts->counter, 1);
+        spinlock_unlock(&ts->lock);
+        thread_sync_wait_ack(ts, version - THREAD_SYNC_RING_SIZE);
+    }
+
+    event = &ts->ring[version % THREAD_SYNC_RING_SIZE];
+    atomic_store_explicit(&event->code, code, memory_order_relaxed);
+    atomic_store_explicit(&event->args, args, memory_order_relaxed);
+    atomic_store_explicit(&ts->version, version, memory_order_release);
+    spinlock_unlock(&ts->lock);
+    return version;
+}
+
+void
+thread_sync_ack_wake__(struct thread_sync *ts)
+{
+    atomic_fetch_add(&ts->ack_seq, 1);
+    if (atomic_load(&ts->ack_sleepers)) {
+        futex_wake(&ts->ack_seq, FUTEX_WAKE_ALL);
+    }
+}
+
+static bool
+thread_sync_acked(struct thread_sync *ts, uint64_t version)
+{
+    bool acked;
+
+    spinlock_lock(&ts->lock);
+    acked = thread_sync_min_ack(ts, version) >= version;
+    spinlock_unlock(&ts->lock);
+    return acked;
+}
+
+/* While "ack_waiters" is set, every ack and unsubscribe advances "ack_seq",
+ * so the subscribers are only rescanned after one of them did */
+void
+thread_sync_wait_ack(struct thread_sync *ts, uint64_t version)
+{
+    uint32_t seq;
+    uint32_t cur;
+
+    atomic_fetch_add(&ts->ack_waiters, 1);
+    seq = atomic_load(&ts->ack_seq);
+    if (thread_sync_acked(ts, version)) {
+        goto out;
+    }
+    for (int i = 0; i < THREAD_SYNC_SPIN; i++) {
+        cur = atomic_load_explicit(&ts->ack_seq, memory_order_relaxed);
+        if (cur != seq) {
+            seq = atomic_load(&ts->ack_seq);
+            if (thread_sync_acked(ts, version)) {
+                goto out;
+            }
         }
-        workers = atomic_load(&ts->workers);
-        /* I was the last thread to increase the counter! */
-        if (retval >= workers-1) {
-            /* Leader gets released, others wait for "thread_sync_continue" */
-            return THREAD_SYNC_WAIT_LEADER;
+        cpu_relax();
+    }
+    while (1) {
+        /* Wakes up at once if an ack came after "seq" was read */
+        atomic_fetch_add(&ts->ack_sleepers, 1);
+        futex_wait(&ts->ack_seq, seq);
+        atomic_fetch_sub(&ts->ack_sleepers, 1);
+        seq = atomic_load(&ts->ack_seq);
+        if (thread_sync_acked(ts, version)) {
+            goto out;
         }
-        usleep(30);
     }
-    /* The signal has changed, return */
-    return THREAD_SYNC_WAIT_WORKER;
+out:
+    atomic_fetch_sub(&ts->ack_waiters, 1);
 }
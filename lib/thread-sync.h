@@ -3,7 +3,9 @@
 
 #include <stdint.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <unistd.h>
+#include "list.h"
 #include "locks.h"
 
 #ifdef __cplusplus
@@ -18,41 +20,88 @@ enum {
 /* Used to synchronize between threads, such that an operation that affects all
  * threads will happen exactly once. */
 
+/* "members" packs the number of registered workers, the number of workers
+ * that arrived at the barrier, and a flag that is set from the moment the
+ * barrier completes until "thread_sync_continue" opens the next one. */
+#define THREAD_SYNC_ARRIVED_MASK 0xffffffffULL
+#define THREAD_SYNC_WORKER (1ULL << 32)
+#define THREAD_SYNC_COMPLETE (1ULL << 63)
+
+/* Slots in the event ring. A publisher waits before overwriting an event
+ * that some subscriber has not acknowledged yet. */
+#define THREAD_SYNC_RING_SIZE 64
+
+struct thread_sync_event {
+    atomic_ulong code;
+    atomic_ulong args;
+};
+
+/* A worker that receives versioned events, see "thread_sync_subscribe".
+ * Owned by a single thread. */
+struct thread_sync_subscriber {
+    /* Last version the subscriber is done with; read by publishers */
+    PADDED_MEMBERS(CACHE_LINE_SIZE, atomic_ulong ack;);
+    uint64_t next;              /* Next version to receive */
+    struct list node;           /* In "subscribers", under "lock" */
+};
+
 struct thread_sync {
     struct spinlock lock;
-    atomic_uint workers;
-    atomic_uint counter;
-    atomic_uint signal;
-    atomic_uint wait_id;
+    struct seqlock event_lock;  /* Keeps event code and args consistent */
+    atomic_ulong members;
+    atomic_uint wait_id;        /* Barrier generation, i.e., the sense */
+    atomic_uint wake_seq;       /* Futex word of parked workers */
+    atomic_uint sleepers;       /* Number of parked workers */
+    atomic_uint promote;        /* Set when an unregister completes a barrier */
     atomic_ulong event_code;
     atomic_ulong event_args;
+
+    /* Versioned events */
+    struct thread_sync_event ring[THREAD_SYNC_RING_SIZE];
+    atomic_ulong version;       /* Last published version */
+    struct list subscribers;
+    atomic_uint ack_seq;        /* Futex word of "thread_sync_wait_ack" */
+    atomic_uint ack_waiters;    /* Threads within "thread_sync_wait_ack" */
+    atomic_uint ack_sleepers;   /* Of which parked */
 };
 
 static inline void
 thread_sync_init(struct thread_sync *ts)
 {
-    atomic_init(&ts->workers, 0);
-    atomic_init(&ts->counter, 0);
-    atomic_init(&ts->signal, 0);
+    atomic_init(&ts->members, 0);
     atomic_init(&ts->wait_id, 0);
+    atomic_init(&ts->wake_seq, 0);
+    atomic_init(&ts->sleepers, 0);
+    atomic_init(&ts->promote, 0);
     atomic_init(&ts->event_code, 0);
     atomic_init(&ts->event_args, 0);
     spinlock_init(&ts->lock);
+    seqlock_init(&ts->event_lock);
+    for (int i = 0; i < THREAD_SYNC_RING_SIZE; i++) {
+        atomic_init(&ts->ring[i].code, 0);
+        atomic_init(&ts->ring[i].args, 0);
+    }
+    atomic_init(&ts->version, 0);
+    list_init(&ts->subscribers);
+    atomic_init(&ts->ack_seq, 0);
+    atomic_init(&ts->ack_waiters, 0);
+    atomic_init(&ts->ack_sleepers, 0);
 }
 
-/* Register a new worker thread */
+/* Register a new worker thread. Safe while other workers are within
+ * "thread_sync_full_barrier": if a barrier is pending, the new worker is
+ * required to complete it; if a barrier has completed but was not continued
+ * yet, the new worker joins the next one. */
 static inline void
 thread_sync_register(struct thread_sync *ts)
 {
-    atomic_fetch_add(&ts->workers, 1);
+    atomic_fetch_add(&ts->members, THREAD_SYNC_WORKER);
 }
 
-/* Unregister an existingworker thread */
-static inline void
-thread_sync_unregister(struct thread_sync *ts)
-{
-    atomic_fetch_sub(&ts->workers, 1);
-}
+/* Unregister an existing worker thread, which must not be within
+ * "thread_sync_full_barrier". Safe while other workers are within it: if
+ * all of them have arrived, one of them becomes the leader. */
+void thread_sync_unregister(struct thread_sync *ts);
 
 /* Read the current event code, relaxed */
 static inline void
@@ -68,17 +117,27 @@ thread_sync_read_relaxed(struct thread_sync *ts,
     }
 }
 
-/* Read the current event code, relaxed */
+/* Read the current event code and args. Never observes the code of one
+ * event with the args of another. */
 static inline void
 thread_sync_read_explicit(struct thread_sync *ts,
                           uint64_t *code,
                           uint64_t *args)
 {
+    uint64_t code_, args_;
+    uint32_t seq;
+
+    do {
+        seq = seqlock_read_begin(&ts->event_lock);
+        code_ = atomic_load_explicit(&ts->event_code, memory_order_relaxed);
+        args_ = atomic_load_explicit(&ts->event_args, memory_order_relaxed);
+    } while (seqlock_read_retry(&ts->event_lock, seq));
+
     if (code) {
-        *code = atomic_load(&ts->event_code);
+        *code = code_;
     }
     if (args) {
-        *args = atomic_load(&ts->event_args);
+        *args = args_;
     }
 }
 
@@ -86,29 +145,104 @@ thread_sync_read_explicit(struct thread_sync *ts,
 static inline void
 thread_sync_set_event(struct thread_sync *ts, uint64_t code, uint64_t args)
 {
-    spinlock_lock(&ts->lock);
-    atomic_store(&ts->event_code, code);
-    atomic_store(&ts->event_args, args);
-    spinlock_unlock(&ts->lock);
+    seqlock_write_lock(&ts->event_lock);
+    atomic_store_explicit(&ts->event_code, code, memory_order_relaxed);
+    atomic_store_explicit(&ts->event_args, args, memory_order_relaxed);
+    seqlock_write_unlock(&ts->event_lock);
 }
 
-/* Releases all worker threads that are stuck within
- * "thread_sync_full_barrier" */
+/* ===== Versioned events =====
+ *
+ * Unlike "thread_sync_set_event", which overwrites a single event, every
+ * published event gets a version and is delivered to every subscriber in
+ * order. A subscriber acknowledges an event by polling again (or calling
+ * "thread_sync_ack") once it is done with it, and publishers may wait until
+ * all subscribers acknowledged a version.
+ *
+ * Usage example (worker):
+ *
+ * thread_sync_subscribe(&ts, &sub);
+ * while (running) {
+ *     while (thread_sync_poll(&ts, &sub, &code, &args)) {
+ *         ...handle event...
+ *     }
+ *     ...
+ * }
+ * thread_sync_unsubscribe(&ts, &sub);
+ */
+
+/* Subscribes "sub" to events published after this call */
+void thread_sync_subscribe(struct thread_sync *ts,
+                           struct thread_sync_subscriber *sub);
+void thread_sync_unsubscribe(struct thread_sync *ts,
+                             struct thread_sync_subscriber *sub);
+
+/* Publishes a new event and returns its version. Waits while the ring is
+ * full of events that were not acknowledged by all subscribers. */
+uint64_t thread_sync_publish(struct thread_sync *ts, uint64_t code,
+                             uint64_t args);
+
+/* Waits until all subscribers acknowledged "version". Spins for a while,
+ * then parks. Only takes "ts->lock" again after some subscriber acked. */
+void thread_sync_wait_ack(struct thread_sync *ts, uint64_t version);
+
+void thread_sync_ack_wake__(struct thread_sync *ts);
+
+/* Subscriber only. Acknowledges all events returned by "thread_sync_poll" */
 static inline void
-thread_sync_continue(struct thread_sync *ts)
+thread_sync_ack(struct thread_sync *ts, struct thread_sync_subscriber *sub)
 {
-    spinlock_lock(&ts->lock);
-    atomic_store(&ts->counter, 0);
-    atomic_fetch_add(&ts->wait_id, 1);
-    spinlock_unlock(&ts->lock);
-};
+    uint64_t done = sub->next - 1;
+
+    if (atomic_load_explicit(&sub->ack, memory_order_relaxed) == done) {
+        return;
+    }
+    /* Sequentially consistent, so that either a waiter sees the ack or we
+     * see the waiter */
+    atomic_store(&sub->ack, done);
+    if (atomic_load(&ts->ack_waiters)) {
+        thread_sync_ack_wake__(ts);
+    }
+}
+
+/* Subscriber only. Acknowledges the previously returned event, then
+ * returns true and sets "code" and "args" to the next event, or returns
+ * false if there is none. Never blocks. */
+static inline bool
+thread_sync_poll(struct thread_sync *ts, struct thread_sync_subscriber *sub,
+                 uint64_t *code, uint64_t *args)
+{
+    struct thread_sync_event *event;
+
+    thread_sync_ack(ts, sub);
+    if (atomic_load_explicit(&ts->version, memory_order_acquire) <
+        sub->next) {
+        return false;
+    }
+
+    /* Published before "version", and cannot be overwritten before we
+     * acknowledge it */
+    event = &ts->ring[sub->next % THREAD_SYNC_RING_SIZE];
+    if (code) {
+        *code = atomic_load_explicit(&event->code, memory_order_relaxed);
+    }
+    if (args) {
+        *args = atomic_load_explicit(&event->args, memory_order_relaxed);
+    }
+    sub->next++;
+    return true;
+}
+
+/* Releases all worker threads that are stuck within
+ * "thread_sync_full_barrier", and opens the next barrier. Called by the
+ * leader. */
+void thread_sync_continue(struct thread_sync *ts);
 
-/* Waits until all threads enter this method. The last thread receives the
- * message returns "THREAD_SYNC_WAIT_LEADER", and returns. All other threads
- * are kept in busy-wait until "thread_sync_continue" is invoked, then return 
- * "THREAD_SYNC_WAIT_WORKER". Note: the behavior of this is undefined if
- * the number of workers is changed while one or more of the threads are in
- * this */
+/* Waits until all registered threads enter this method. The last thread to
+ * arrive returns "THREAD_SYNC_WAIT_LEADER". All other threads spin for a
+ * while and then park until "thread_sync_continue" is invoked, then return
+ * "THREAD_SYNC_WAIT_WORKER". Workers may register and unregister while
+ * others are in this. */
 int thread_sync_full_barrier(struct thread_sync *ts);
 
 #ifdef __cplusplus
@@ -1,9 +1,32 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdatomic.h>
 #include "util.h"
 
+/* Holds the thread id plus one, or 0 before the first "thread_id" call */
+__thread unsigned int thread_id__;
+static atomic_uint next_thread_id;
+
+unsigned int
+thread_id_init__(void)
+{
+    unsigned int id = atomic_fetch_add_explicit(&next_thread_id, 1,
+                                                memory_order_relaxed);
+    thread_id__ = id + 1;
+    return id;
+}
+
+unsigned int
+current_cpu(void)
+{
+    int cpu = sched_getcpu();
+    return cpu >= 0 ? cpu : 0;
+}
+
 int
 int_compare_dec(void *a, void *b)
 {
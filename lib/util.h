@@ -309,6 +309,36 @@ typedef uint8_t CACHE_LINE_MARKER[1];
 #define ALIGNED_VAR(N) __declspec(align(N))
 #endif
 
+/* Hints the CPU that the caller is busy-waiting, which saves power and
+ * frees resources for a sibling hyper-thread. */
+static inline void
+cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+/* Returns a small id of the calling thread. Ids are unique among all
+ * threads of the process, start at 0 and are never reused. */
+extern __thread unsigned int thread_id__;
+unsigned int thread_id_init__(void);
+
+static inline unsigned int
+thread_id(void)
+{
+    unsigned int id = thread_id__;
+    return LIKELY(id) ? id - 1 : thread_id_init__();
+}
+
+/* Returns the CPU the calling thread runs on, or 0 if unknown. The thread
+ * may migrate right after, so use it only to spread load, e.g., to pick a
+ * per-CPU slot that is cache-hot on the current core. */
+unsigned int current_cpu(void);
 
 void abort_msg(const char *msg);
 
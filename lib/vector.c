@@ -3,19 +3,44 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "util.h"
 #include "vector.h"
 #include "list.h"
+#include "sort.h"
 
 #define CHUNK_SIZE 4076
 
+/* On-disk format: a header padded to a cache line, followed by all elements
+ * packed back to back. See "vector_save" and "vector_map". */
+#define VECTOR_FILE_MAGIC 0x524f544345564c43ULL /* "CLVECTOR" */
+#define VECTOR_FILE_VERSION 1
+#define VECTOR_FILE_IOV 64
+
+struct vector_file_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t elem_size;
+    uint64_t elements;
+    uint64_t payload_offset; /* Offset of first element within the file */
+};
+
 struct vector {
-    struct list chunks; /* List of chunks in this */
-    size_t elements;    /* Total number of elements */
-    atomic_uint lock;   /* Private spinlock */
-    int elem_size;      /* Bytes per element */
-    int num_chunks;     /* Number of chunks */
+    struct list chunks;      /* List of chunks in this */
+    struct list free_chunks; /* Recycled chunks, reused by pushes */
+    size_t elements;         /* Total number of elements */
+    atomic_uint lock;        /* Private spinlock */
+    int elem_size;           /* Bytes per element */
+    int num_chunks;          /* Number of chunks */
+    void *map;               /* File mapping, NULL unless read-only */
+    size_t map_size;         /* Size of "map" in bytes */
+    const char *payload;     /* First element within "map" */
 };
 
 /* A chunk is 4KB size */
@@ -26,21 +51,36 @@ struct chunk {
 };
 
 
-/* Init new chunk */
+/* Init new chunk, prefer a recycled chunk of "vector" over allocation */
 static struct chunk*
-chunk_init()
+chunk_init(struct vector *vector)
 {
     struct chunk *chunk;
-    chunk = xmalloc(sizeof(*chunk));
+    if (!list_is_empty(&vector->free_chunks)) {
+        chunk = CONTAINER_OF(list_pop_back(&vector->free_chunks),
+                             struct chunk,
+                             node);
+    } else {
+        chunk = xmalloc(sizeof(*chunk));
+    }
     chunk->size = 0;
     return chunk;
 }
 
+/* Move the last chunk of "vector" to its free list */
+static void
+chunk_recycle(struct vector *vector)
+{
+    struct list *node = list_pop_back(&vector->chunks);
+    list_push_back(&vector->free_chunks, node);
+    vector->num_chunks--;
+}
+
 /* Chunk is full */
 static inline bool
 chunk_is_full(struct chunk *chunk, const int elem_size)
 {
-    return chunk->size + elem_size>= CHUNK_SIZE;
+    return chunk->size + elem_size > CHUNK_SIZE;
 }
 
 /* Push new element */
@@ -57,9 +97,13 @@ vector_init(int elem_size)
     struct vector *vector;
     vector = xmalloc(sizeof(*vector));
     list_init(&vector->chunks);
+    list_init(&vector->free_chunks);
     vector->elements = 0;
     vector->num_chunks = 0;
     vector->elem_size = elem_size;
+    vector->map = NULL;
+    vector->map_size = 0;
+    vector->payload = NULL;
     ASSERT(elem_size); /* Must not be zero */
     atomic_init(&vector->lock, 0);
     return vector;
@@ -75,9 +119,31 @@ vector_destroy(struct vector *vector)
     LIST_FOR_EACH_POP(chunk, node, &vector->chunks) {
         free(chunk);
     }
+    LIST_FOR_EACH_POP(chunk, node, &vector->free_chunks) {
+        free(chunk);
+    }
+    if (vector->map) {
+        munmap(vector->map, vector->map_size);
+    }
     free(vector);
 }
 
+/* Mapped vectors are backed by a read-only file mapping */
+static inline void
+vector_check_writable(struct vector *vector)
+{
+    if (vector->map) {
+        abort_msg("vector: cannot modify a mapped vector");
+    }
+}
+
+/* Number of elements that fit in a single chunk */
+static inline size_t
+vector_chunk_elements(struct vector *vector)
+{
+    return CHUNK_SIZE / vector->elem_size;
+}
+
 static inline void
 vector_lock(struct vector *vector)
 {
@@ -106,40 +172,105 @@ vector_size(struct vector *vector)
 void
 vector_push(struct vector *vector, const void *element)
 {
-    struct chunk *chunk = NULL;
-
     vector_lock(vector);
+    vector_push_unsafe(vector, element);
+    vector_unlock(vector);
+}
+
+void
+vector_push_unsafe(struct vector *vector, const void *element)
+{
+    struct chunk *chunk = NULL;
+    vector_check_writable(vector);
     if (!list_is_empty(&vector->chunks)) {
         chunk = CONTAINER_OF(list_back(&vector->chunks), struct chunk, node);
     }
 
     if (!chunk || chunk_is_full(chunk, vector->elem_size)) {
-        chunk = chunk_init();
+        chunk = chunk_init(vector);
         list_push_back(&vector->chunks, &chunk->node);
         vector->num_chunks++;
     }
 
     chunk_push(chunk, element, vector->elem_size);
     vector->elements++;
-    vector_unlock(vector);
 }
 
 void
-vector_push_unsafe(struct vector *vector, const void *element)
+vector_clear(struct vector *vector)
 {
-    struct chunk *chunk = NULL;
-    if (!list_is_empty(&vector->chunks)) {
+    vector_check_writable(vector);
+    vector_lock(vector);
+    list_push_back_all(&vector->free_chunks, &vector->chunks);
+    vector->num_chunks = 0;
+    vector->elements = 0;
+    vector_unlock(vector);
+}
+
+/* Removes the last "num" elements of "vector". Emptied chunks are moved to
+ * the free list, so the vector never holds an empty chunk. */
+static void
+vector_remove_back(struct vector *vector, size_t num)
+{
+    struct chunk *chunk;
+    size_t chunk_elements;
+    size_t count;
+
+    while (num) {
         chunk = CONTAINER_OF(list_back(&vector->chunks), struct chunk, node);
+        chunk_elements = chunk->size / vector->elem_size;
+        count = MIN(chunk_elements, num);
+        chunk->size -= count * vector->elem_size;
+        vector->elements -= count;
+        num -= count;
+        if (!chunk->size) {
+            chunk_recycle(vector);
+        }
     }
+}
 
-    if (!chunk || chunk_is_full(chunk, vector->elem_size)) {
-        chunk = chunk_init();
-        list_push_back(&vector->chunks, &chunk->node);
-        vector->num_chunks++;
+void
+vector_truncate(struct vector *vector, size_t size)
+{
+    vector_check_writable(vector);
+    vector_lock(vector);
+    if (size < vector->elements) {
+        vector_remove_back(vector, vector->elements - size);
     }
+    vector_unlock(vector);
+}
 
-    chunk_push(chunk, element, vector->elem_size);
-    vector->elements++;
+bool
+vector_pop(struct vector *vector, void *element)
+{
+    struct chunk *chunk;
+
+    vector_check_writable(vector);
+    vector_lock(vector);
+    if (!vector->elements) {
+        vector_unlock(vector);
+        return false;
+    }
+    if (element) {
+        chunk = CONTAINER_OF(list_back(&vector->chunks), struct chunk, node);
+        memcpy(element,
+               &chunk->items[chunk->size - vector->elem_size],
+               vector->elem_size);
+    }
+    vector_remove_back(vector, 1);
+    vector_unlock(vector);
+    return true;
+}
+
+void
+vector_shrink(struct vector *vector)
+{
+    struct chunk *chunk;
+    vector_lock(vector);
+    LIST_FOR_EACH_POP(chunk, node, &vector->free_chunks) {
+        free(chunk);
+    }
+    vector_unlock(vector);
 }
 
 void*
@@ -157,7 +288,13 @@ vector_get_slow(struct vector *vector, size_t idx)
         return NULL;
     }
 
-    elem_per_chunk = CHUNK_SIZE / vector->elem_size;
+    if (vector->map) {
+        ptr = (void*)&vector->payload[idx*vector->elem_size];
+        vector_unlock(vector);
+        return ptr;
+    }
+
+    elem_per_chunk = vector_chunk_elements(vector);
     chunk_idx = idx / elem_per_chunk;
 
     LIST_FOR_EACH(chunk, node, &vector->chunks) {
@@ -190,9 +327,21 @@ vector_begin(struct vector *vector)
     return it;
 }
 
+/* Mapped vectors are iterated in virtual chunks of the same length as
+ * regular chunks, so "chunk_index" and "elem_index" keep their meaning */
+static inline size_t
+vector_iterator_index(struct vector_iterator *it)
+{
+    return (size_t)it->chunk_index * vector_chunk_elements(it->vector) +
+           it->elem_index;
+}
+
 bool
 vector_iterator_valid(struct vector_iterator *it)
 {
+    if (it->vector && it->vector->map) {
+        return vector_iterator_index(it) < it->vector->elements;
+    }
 
     if (!it->vector || ! it->chunk) {
         return false;
@@ -209,6 +358,13 @@ vector_iterator_valid(struct vector_iterator *it)
 void
 vector_iterator_next(struct vector_iterator *it)
 {
+    if (it->vector && it->vector->map) {
+        if (++it->elem_index == vector_chunk_elements(it->vector)) {
+            it->chunk_index++;
+            it->elem_index = 0;
+        }
+        return;
+    }
     if (!it->chunk) {
         return;
     }
@@ -227,6 +383,247 @@ vector_iterator_next(struct vector_iterator *it)
 void*
 vector_iterator_get(struct vector_iterator *it)
 {
+    if (it->vector && it->vector->map) {
+        return (void*)&it->vector->payload[vector_iterator_index(it) *
+                                           it->vector->elem_size];
+    }
     return it->chunk ? 
            &it->chunk->items[it->elem_index*it->vector->elem_size] : 0;
 }
+
+int
+vector_elem_size(struct vector *vector)
+{
+    return vector->elem_size;
+}
+
+/* Writes all "iovcnt" buffers in "iov" to "fd", retrying on partial writes.
+ * Modifies "iov". Returns 0 on success, -1 on error (errno is set). */
+static int
+vector_writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t bytes;
+
+    while (iovcnt) {
+        bytes = writev(fd, iov, iovcnt);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (iovcnt && bytes >= iov->iov_len) {
+            bytes -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt) {
+            iov->iov_base = (char*)iov->iov_base + bytes;
+            iov->iov_len -= bytes;
+        }
+    }
+    return 0;
+}
+
+int
+vector_save(struct vector *vector, int fd)
+{
+    char header[ROUND_UP(sizeof(struct vector_file_header), CACHE_LINE_SIZE)];
+    struct vector_file_header *hdr = (struct vector_file_header*)header;
+    struct iovec iov[VECTOR_FILE_IOV];
+    struct chunk *chunk;
+    int iovcnt;
+    int retval;
+
+    memset(header, 0, sizeof(header));
+    hdr->magic = VECTOR_FILE_MAGIC;
+    hdr->version = VECTOR_FILE_VERSION;
+    hdr->elem_size = vector->elem_size;
+    hdr->payload_offset = sizeof(header);
+
+    vector_lock(vector);
+    hdr->elements = vector->elements;
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iovcnt = 1;
+    retval = 0;
+
+    if (vector->map) {
+        iov[1].iov_base = (void*)vector->payload;
+        iov[1].iov_len = vector->elements * vector->elem_size;
+        iovcnt = 2;
+    } else {
+        /* All chunks but the last are full, so concatenating their payloads
+         * yields the elements packed back to back */
+        LIST_FOR_EACH(chunk, node, &vector->chunks) {
+            if (iovcnt == VECTOR_FILE_IOV) {
+                retval = vector_writev_all(fd, iov, iovcnt);
+                if (retval) {
+                    goto out;
+                }
+                iovcnt = 0;
+            }
+            iov[iovcnt].iov_base = chunk->items;
+            iov[iovcnt].iov_len = chunk->size;
+            iovcnt++;
+        }
+    }
+    retval = vector_writev_all(fd, iov, iovcnt);
+out:
+    vector_unlock(vector);
+    return retval;
+}
+
+struct vector *
+vector_map(const char *path)
+{
+    struct vector_file_header hdr;
+    struct vector *vector;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st)) {
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size < (off_t)sizeof(hdr)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    /* Pages are faulted in lazily on first access */
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    memcpy(&hdr, map, sizeof(hdr));
+    if (hdr.magic != VECTOR_FILE_MAGIC ||
+        hdr.version != VECTOR_FILE_VERSION ||
+        !hdr.elem_size ||
+        hdr.elem_size > CHUNK_SIZE ||
+        hdr.payload_offset < sizeof(hdr) ||
+        hdr.payload_offset > st.st_size ||
+        hdr.elements > (st.st_size - hdr.payload_offset) / hdr.elem_size) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    vector = vector_init(hdr.elem_size);
+    vector->elements = hdr.elements;
+    vector->map = map;
+    vector->map_size = st.st_size;
+    vector->payload = (const char*)map + hdr.payload_offset;
+    return vector;
+}
+
+/* Sorts the keys of "vector" along with their original indices, and returns
+ * the indices. The result holds, for each position, the index of the element
+ * that should move there. */
+static size_t *
+vector_sort_indices(struct vector *vector, size_t key_offset,
+                    enum sort_key_type type)
+{
+    struct vector_iterator it;
+    size_t *indices;
+    size_t n, i;
+    char *elem;
+    void *keys;
+
+    n = vector->elements;
+    indices = xmalloc(sizeof(*indices) * n);
+    keys = xmalloc((type == SORT_KEY_UINT64 ? 8 : 4) * n);
+
+    i = 0;
+    for (it = vector_begin(vector);
+         vector_iterator_valid(&it);
+         vector_iterator_next(&it), i++) {
+        elem = vector_iterator_get(&it);
+        indices[i] = i;
+        if (type == SORT_KEY_UINT64) {
+            memcpy(&((uint64_t*)keys)[i], elem + key_offset, 8);
+        } else {
+            memcpy(&((uint32_t*)keys)[i], elem + key_offset, 4);
+        }
+    }
+
+    switch (type) {
+    case SORT_KEY_UINT32:
+        sort_uint32_parallel(keys, indices, sizeof(*indices), n, 0);
+        break;
+    case SORT_KEY_UINT64:
+        sort_uint64_parallel(keys, indices, sizeof(*indices), n, 0);
+        break;
+    case SORT_KEY_FLOAT:
+        sort_float_parallel(keys, indices, sizeof(*indices), n, 0);
+        break;
+    }
+
+    free(keys);
+    return indices;
+}
+
+void
+vector_sort(struct vector *vector, size_t key_offset, enum sort_key_type type)
+{
+    struct chunk **chunks;
+    struct chunk *chunk;
+    size_t per_chunk;
+    size_t *indices;
+    size_t i, j, k;
+    char *tmp;
+    int idx;
+
+    vector_check_writable(vector);
+    vector_lock(vector);
+    if (vector->elements < 2) {
+        vector_unlock(vector);
+        return;
+    }
+
+    indices = vector_sort_indices(vector, key_offset, type);
+
+    /* Random access to elements through a table of chunks */
+    per_chunk = vector_chunk_elements(vector);
+    chunks = xmalloc(sizeof(*chunks) * vector->num_chunks);
+    idx = 0;
+    LIST_FOR_EACH(chunk, node, &vector->chunks) {
+        chunks[idx++] = chunk;
+    }
+
+#define VECTOR_ELEMENT(I) \
+    (&chunks[(I) / per_chunk]->items[((I) % per_chunk) * vector->elem_size])
+
+    /* Apply the permutation in place by following its cycles. Each handled
+     * position is marked by pointing to itself. */
+    tmp = xmalloc(vector->elem_size);
+    for (i = 0; i < vector->elements; i++) {
+        if (indices[i] == i) {
+            continue;
+        }
+        memcpy(tmp, VECTOR_ELEMENT(i), vector->elem_size);
+        j = i;
+        while (indices[j] != i) {
+            k = indices[j];
+            memcpy(VECTOR_ELEMENT(j), VECTOR_ELEMENT(k), vector->elem_size);
+            indices[j] = j;
+            j = k;
+        }
+        memcpy(VECTOR_ELEMENT(j), tmp, vector->elem_size);
+        indices[j] = j;
+    }
+
+#undef VECTOR_ELEMENT
+
+    vector_unlock(vector);
+    free(tmp);
+    free(chunks);
+    free(indices);
+}
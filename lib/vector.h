@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include "sort.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,8 +30,34 @@ size_t vector_size(struct vector *vector);
 void vector_push(struct vector *vector, const void *element);
 /* Insert "element" into "vector". Fast, thread unsafe. */
 void vector_push_unsafe(struct vector *vector, const void *element);
+/* Removes all elements from "vector". Chunks are kept for reuse, so refilling
+ * the vector does not allocate. Thread safe. */
+void vector_clear(struct vector *vector);
+/* Removes elements from the end of "vector" until it holds at most "size"
+ * elements. Thread safe. */
+void vector_truncate(struct vector *vector, size_t size);
+/* Removes the last element of "vector" and copies it to "element" (unless
+ * NULL). Returns false iff "vector" is empty. Thread safe. */
+bool vector_pop(struct vector *vector, void *element);
+/* Releases the memory of chunks kept for reuse. Thread safe. */
+void vector_shrink(struct vector *vector);
 /* Get a pointer to a random element with "idx" within "vector". Thread safe */
 void* vector_get_slow(struct vector *vector, size_t idx);
+/* Returns the size in bytes of each element in "vector" */
+int vector_elem_size(struct vector *vector);
+/* Writes all elements of "vector" to "fd" using a format that can be loaded
+ * by "vector_map". Returns 0 on success, or -1 and sets errno. Thread safe. */
+int vector_save(struct vector *vector, int fd);
+/* Returns a read-only vector backed by a memory mapping of the file in
+ * "path", which was written by "vector_save". Elements are not copied; pages
+ * are loaded on first access. Modifying the returned vector aborts. Returns
+ * NULL and sets errno on failure. Release with "vector_destroy". */
+struct vector* vector_map(const char *path);
+/* Sorts the elements of "vector" in ascending order of a key of type "type"
+ * found "key_offset" bytes into each element. Elements are permuted in place
+ * within their chunks; only keys and indices are copied aside. Thread safe. */
+void vector_sort(struct vector *vector, size_t key_offset,
+                 enum sort_key_type type);
 /* Returns an iterator to the beginning of the vector */
 struct vector_iterator vector_begin(struct vector *vector);
 /* Returns true iff "it" is valid */
@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "ws-deque.h"
+#include "workpool.h"
+
+/* Slots in each worker's deque. Ranges are split in halves, so a worker holds
+ * at most log2(range) tasks at any time. */
+#define WORKPOOL_DEQUE_SIZE 256
+
+/* Upper bound of leaf ranges per worker; finer grains are coarsened */
+#define WORKPOOL_TASKS_PER_WORKER 1024
+
+/* Failed steal rounds before yielding the CPU */
+#define WORKPOOL_SPIN 64
+
+struct workpool_task {
+    size_t begin;
+    size_t end;
+};
+
+struct workpool_job {
+    workpool_func_t func;
+    void *args;
+    size_t grain;
+    struct workpool_task *tasks;
+    size_t num_tasks;
+    atomic_size_t next_task;
+    atomic_size_t remaining;  /* Elements not processed yet */
+};
+
+struct workpool_worker {
+    struct ws_deque deque;
+    struct workpool *pool;
+    pthread_t thread;
+    uint32_t seed;
+    int id;
+};
+
+struct workpool {
+    struct workpool_worker *workers;
+    int num_workers;
+
+    /* Helpers sleep on "wake" while there is no new job. A plain pthread
+     * mutex, as idle time would otherwise count as hold time of a profiled
+     * "struct mutex". */
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    struct workpool_job *job;
+    uint64_t generation;
+    bool exit;
+
+    /* Number of helpers that may still access the current job */
+    atomic_int busy;
+};
+
+static inline uint32_t
+workpool_random(struct workpool_worker *worker)
+{
+    uint32_t x = worker->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    worker->seed = x;
+    return x;
+}
+
+static struct workpool_task *
+workpool_steal(struct workpool_worker *worker)
+{
+    struct workpool *pool = worker->pool;
+    struct workpool_task *task;
+    int victim;
+
+    victim = workpool_random(worker) % pool->num_workers;
+    for (int i = 0; i < pool->num_workers; i++) {
+        if (victim != worker->id) {
+            task = ws_deque_steal(&pool->workers[victim].deque);
+            if (task) {
+                return task;
+            }
+        }
+        victim = (victim + 1) % pool->num_workers;
+    }
+    return NULL;
+}
+
+/* Splits "task" in halves, pushing the upper halves to the worker's deque so
+ * that thieves take the largest ranges, then processes the remaining range */
+static void
+workpool_execute(struct workpool_worker *worker, struct workpool_job *job,
+                 struct workpool_task *task)
+{
+    size_t begin = task->begin;
+    size_t end = task->end;
+    struct workpool_task *split;
+    size_t index;
+    size_t mid;
+
+    while (end - begin > job->grain) {
+        index = atomic_fetch_add_explicit(&job->next_task, 1,
+                                          memory_order_relaxed);
+        if (index >= job->num_tasks) {
+            break;
+        }
+        mid = begin + (end - begin) / 2;
+        split = &job->tasks[index];
+        split->begin = mid;
+        split->end = end;
+        if (!ws_deque_push(&worker->deque, split)) {
+            break;
+        }
+        end = mid;
+    }
+
+    for (size_t i = begin; i < end; i += job->grain) {
+        job->func(i, MIN(i + job->grain, end), job->args);
+    }
+    atomic_fetch_sub_explicit(&job->remaining, end - begin,
+                              memory_order_release);
+}
+
+static void
+workpool_run(struct workpool_worker *worker, struct workpool_job *job)
+{
+    struct workpool_task *task;
+    int spins = 0;
+
+    while (atomic_load_explicit(&job->remaining, memory_order_acquire)) {
+        task = ws_deque_pop(&worker->deque);
+        if (!task) {
+            task = workpool_steal(worker);
+        }
+        if (task) {
+            workpool_execute(worker, job, task);
+            spins = 0;
+        } else if (++spins >= WORKPOOL_SPIN) {
+            sched_yield();
+            spins = 0;
+        }
+    }
+}
+
+static void *
+workpool_thread(void *args)
+{
+    struct workpool_worker *worker = args;
+    struct workpool *pool = worker->pool;
+    uint64_t generation = 0;
+    struct workpool_job *job;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (true) {
+        while (!pool->exit &&
+               (!pool->job || pool->generation == generation)) {
+            if (pthread_cond_wait(&pool->wake, &pool->mutex)) {
+                abort_msg("pthread_cond_wait fail");
+            }
+        }
+        if (pool->exit) {
+            break;
+        }
+        job = pool->job;
+        generation = pool->generation;
+        atomic_fetch_add(&pool->busy, 1);
+        pthread_mutex_unlock(&pool->mutex);
+
+        workpool_run(worker, job);
+        atomic_fetch_sub_explicit(&pool->busy, 1, memory_order_release);
+
+        pthread_mutex_lock(&pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+struct workpool *
+workpool_create(int threads)
+{
+    struct workpool *pool;
+
+    if (threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = MAX(threads, 1);
+    }
+
+    pool = xmalloc(sizeof(*pool));
+    pool->workers = xmalloc_cacheline(sizeof(*pool->workers) * threads);
+    pool->num_workers = threads;
+    pool->job = NULL;
+    pool->generation = 0;
+    pool->exit = false;
+    atomic_init(&pool->busy, 0);
+    if (pthread_mutex_init(&pool->mutex, NULL)) {
+        abort_msg("pthread_mutex_init fail");
+    }
+    if (pthread_cond_init(&pool->wake, NULL)) {
+        abort_msg("pthread_cond_init fail");
+    }
+
+    for (int i = 0; i < threads; i++) {
+        struct workpool_worker *worker = &pool->workers[i];
+        ws_deque_init(&worker->deque, WORKPOOL_DEQUE_SIZE);
+        worker->pool = pool;
+        worker->id = i;
+        worker->seed = 0x9e3779b9u * (i + 1);
+    }
+
+    /* Worker 0 is the thread that calls "workpool_parallel_for" */
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, workpool_thread,
+                           &pool->workers[i])) {
+            abort_msg("pthread_create fail");
+        }
+    }
+    return pool;
+}
+
+void
+workpool_destroy(struct workpool *pool)
+{
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->exit = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 1; i < pool->num_workers; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < pool->num_workers; i++) {
+        ws_deque_destroy(&pool->workers[i].deque);
+    }
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->mutex);
+    free_cacheline(pool->workers);
+    free(pool);
+}
+
+int
+workpool_size(struct workpool *pool)
+{
+    return pool->num_workers;
+}
+
+void
+workpool_parallel_for(struct workpool *pool, size_t begin, size_t end,
+                      size_t grain, workpool_func_t func, void *args)
+{
+    struct workpool_job job;
+    size_t leaves;
+    size_t n;
+
+    if (end <= begin) {
+        return;
+    }
+    n = end - begin;
+    grain = MAX(grain, 1);
+    grain = MAX(grain, DIV_ROUND_UP(n, (size_t)pool->num_workers *
+                                       WORKPOOL_TASKS_PER_WORKER));
+
+    if (pool->num_workers == 1 || n <= grain) {
+        for (size_t i = begin; i < end; i += grain) {
+            func(i, MIN(i + grain, end), args);
+        }
+        return;
+    }
+
+    /* Each split creates one task, and halving never leaves ranges smaller
+     * than half the grain, so there are fewer than 2n/grain leaves */
+    leaves = 2 * DIV_ROUND_UP(n, grain) + 1;
+    job.func = func;
+    job.args = args;
+    job.grain = grain;
+    job.num_tasks = leaves + 1;
+    job.tasks = xmalloc(sizeof(*job.tasks) * job.num_tasks);
+    job.tasks[0].begin = begin;
+    job.tasks[0].end = end;
+    atomic_init(&job.next_task, 1);
+    atomic_init(&job.remaining, n);
+    ws_deque_push(&pool->workers[0].deque, &job.tasks[0]);
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->job = &job;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->mutex);
+
+    workpool_run(&pool->workers[0], &job);
+
+    /* Helpers that picked up the job may still be scanning deques */
+    pthread_mutex_lock(&pool->mutex);
+    pool->job = NULL;
+    pthread_mutex_unlock(&pool->mutex);
+    while (atomic_load_explicit(&pool->busy, memory_order_acquire)) {
+        sched_yield();
+    }
+    free(job.tasks);
+}
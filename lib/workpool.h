@@ -0,0 +1,42 @@
+#ifndef _WORKPOOL_H
+#define _WORKPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A pool of worker threads that balances work using per-worker
+ * work-stealing deques. Ranges are split recursively: a worker keeps
+ * splitting its range in half, pushing one half to its own deque, until the
+ * range is no larger than the grain size. Idle workers steal the oldest
+ * (largest) ranges of random victims. */
+
+struct workpool;
+
+/* Processes the elements in [begin, end) */
+typedef void (*workpool_func_t)(size_t begin, size_t end, void *args);
+
+/* Creates a pool of "threads" workers, including the thread that calls
+ * "workpool_parallel_for". Set "threads" to 0 to use all online CPUs. */
+struct workpool *workpool_create(int threads);
+void workpool_destroy(struct workpool *pool);
+
+/* Returns the number of workers in "pool" */
+int workpool_size(struct workpool *pool);
+
+/* Calls "func" on sub-ranges of [begin, end) of at most "grain" elements
+ * using all workers of "pool", and returns when all elements are processed.
+ * The calling thread participates. Very small grains may be coarsened to
+ * bound the bookkeeping. Only one thread may call this at a time, and "func"
+ * must not call it recursively. */
+void workpool_parallel_for(struct workpool *pool, size_t begin, size_t end,
+                           size_t grain, workpool_func_t func, void *args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef _WS_DEQUE_H
+#define _WS_DEQUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Chase-Lev work-stealing deque of pointers with a fixed capacity. The owner
+ * thread pushes and pops at the bottom (LIFO), while other threads steal from
+ * the top (FIFO). Only the owner may call "ws_deque_push" and
+ * "ws_deque_pop". Memory orders follow Le et al., "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" (PPoPP 2013). */
+
+struct ws_deque {
+    /* Read-only after init */
+    PADDED_MEMBERS(CACHE_LINE_SIZE,
+        _Atomic(void *) *buffer;
+        long mask;
+    );
+    /* Advanced by thieves */
+    PADDED_MEMBERS(CACHE_LINE_SIZE, atomic_long top;);
+    /* Written by the owner */
+    PADDED_MEMBERS(CACHE_LINE_SIZE, atomic_long bottom;);
+};
+
+/* Initiates "deque" with "size" slots. "size" must be a power of 2 */
+static inline void
+ws_deque_init(struct ws_deque *deque, size_t size)
+{
+    if (!IS_POW2(size)) {
+        abort_msg("ws_deque_init: size must be a power of 2");
+    }
+    deque->buffer = xmalloc_cacheline(sizeof(*deque->buffer) * size);
+    deque->mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&deque->buffer[i], NULL);
+    }
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+}
+
+static inline void
+ws_deque_destroy(struct ws_deque *deque)
+{
+    if (!deque) {
+        return;
+    }
+    free_cacheline(deque->buffer);
+    deque->buffer = NULL;
+}
+
+/* Returns the approximate number of elements in "deque" */
+static inline size_t
+ws_deque_size(struct ws_deque *deque)
+{
+    long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    return b > t ? b - t : 0;
+}
+
+/* Owner only. Inserts "item" at the bottom of "deque". Returns false iff
+ * "deque" is full. */
+static inline bool
+ws_deque_push(struct ws_deque *deque, void *item)
+{
+    long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+    if (b - t > deque->mask) {
+        return false;
+    }
+    atomic_store_explicit(&deque->buffer[b & deque->mask], item,
+                          memory_order_relaxed);
+    /* Publishes the item to thieves that acquire "bottom" */
+    atomic_store_explicit(&deque->bottom, b + 1, memory_order_release);
+    return true;
+}
+
+/* Owner only. Removes and returns the bottom item of "deque", or NULL if
+ * "deque" is empty. */
+static inline void *
+ws_deque_pop(struct ws_deque *deque)
+{
+    long b = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    void *item;
+    long t;
+
+    atomic_store_explicit(&deque->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (t > b) {
+        /* Empty */
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    item = atomic_load_explicit(&deque->buffer[b & deque->mask],
+                                memory_order_relaxed);
+    if (t == b) {
+        /* Last item, race against thieves */
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed)) {
+            item = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, b + 1, memory_order_relaxed);
+    }
+    return item;
+}
+
+/* Thread safe. Removes and returns the top item of "deque". Returns NULL if
+ * "deque" is empty or if another thread won the race for the item. */
+static inline void *
+ws_deque_steal(struct ws_deque *deque)
+{
+    long t = atomic_load_explicit(&deque->top, memory_order_acquire);
+    void *item;
+    long b;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (t >= b) {
+        return NULL;
+    }
+
+    item = atomic_load_explicit(&deque->buffer[t & deque->mask],
+                                memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+        return NULL;
+    }
+    return item;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,302 @@
+#define _XOPEN_SOURCE 700
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "lib/util.h"
+#include "lib/cpu-topology.h"
+
+#define TEMP_DIR "/tmp/test-cpu-topology-XXXXXX"
+
+/* The full tree: 2 packages on 2 NUMA nodes, 4 cores each, 2 SMT threads
+ * per core. CPUs 0-7 are the first threads of cores, 8-15 their siblings,
+ * as Linux numbers them on x86. */
+#define FULL_CPUS 16
+
+static bool error;
+static char root[sizeof(TEMP_DIR)];
+
+#define CHECK(COND)                                                      \
+    do {                                                                 \
+        if (!(COND)) {                                                   \
+            printf("Failed: %s (line %d)\n", #COND, __LINE__);           \
+            error = true;                                                \
+        }                                                                \
+    } while (0)
+
+/* Creates "root"/PATH, and its parent directories, with "content" */
+static void
+write_file(const char *content, const char *format, ...)
+{
+    char path[512];
+    size_t len;
+    va_list args;
+    FILE *file;
+    int n;
+
+    n = snprintf(path, sizeof(path), "%s/", root);
+    va_start(args, format);
+    vsnprintf(path + n, sizeof(path) - n, format, args);
+    va_end(args);
+
+    len = strlen(path);
+    for (size_t i = strlen(root) + 1; i < len; i++) {
+        if (path[i] == '/') {
+            path[i] = '\0';
+            mkdir(path, 0755);
+            path[i] = '/';
+        }
+    }
+    if (!content) {
+        mkdir(path, 0755);
+        return;
+    }
+    file = fopen(path, "w");
+    if (!file) {
+        abort_msg("cannot create fake sysfs file");
+    }
+    fprintf(file, "%s\n", content);
+    fclose(file);
+}
+
+static int
+remove_entry(const char *path, const struct stat *st, int flag,
+             struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+
+static void
+make_root(void)
+{
+    strcpy(root, TEMP_DIR);
+    if (!mkdtemp(root)) {
+        abort_msg("mkdtemp fail");
+    }
+}
+
+static void
+remove_root(void)
+{
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void
+write_full_tree(void)
+{
+    char buf[64];
+
+    write_file("0-15", "cpu/online");
+    for (int cpu = 0; cpu < FULL_CPUS; cpu++) {
+        int core = cpu % 8;
+        int package = core / 4;
+
+        snprintf(buf, sizeof(buf), "%d", package);
+        write_file(buf, "cpu/cpu%d/topology/physical_package_id", cpu);
+        snprintf(buf, sizeof(buf), "%d", core % 4);
+        write_file(buf, "cpu/cpu%d/topology/core_id", cpu);
+        snprintf(buf, sizeof(buf), "%d,%d", core, core + 8);
+        write_file(buf, "cpu/cpu%d/topology/thread_siblings_list", cpu);
+        /* Stands for the "nodeN" symlink */
+        write_file(NULL, "cpu/cpu%d/node%d", cpu, package);
+    }
+    write_file("0-3,8-11", "node/node0/cpulist");
+    write_file("4-7,12-15", "node/node1/cpulist");
+
+    write_file("1", "cpu/cpu0/cache/index0/level");
+    write_file("Data", "cpu/cpu0/cache/index0/type");
+    write_file("32K", "cpu/cpu0/cache/index0/size");
+    write_file("64", "cpu/cpu0/cache/index0/coherency_line_size");
+    write_file("0,8", "cpu/cpu0/cache/index0/shared_cpu_list");
+    write_file("1", "cpu/cpu0/cache/index1/level");
+    write_file("Instruction", "cpu/cpu0/cache/index1/type");
+    write_file("64K", "cpu/cpu0/cache/index1/size");
+    write_file("2", "cpu/cpu0/cache/index2/level");
+    write_file("Unified", "cpu/cpu0/cache/index2/type");
+    write_file("1M", "cpu/cpu0/cache/index2/size");
+    write_file("64", "cpu/cpu0/cache/index2/coherency_line_size");
+    write_file("0,8", "cpu/cpu0/cache/index2/shared_cpu_list");
+    write_file("3", "cpu/cpu0/cache/index3/level");
+    write_file("Unified", "cpu/cpu0/cache/index3/type");
+    write_file("16M", "cpu/cpu0/cache/index3/size");
+    write_file("64", "cpu/cpu0/cache/index3/coherency_line_size");
+    write_file("0-3,8-11", "cpu/cpu0/cache/index3/shared_cpu_list");
+}
+
+static void
+check_order(const struct cpu_topology *topo, enum cpu_pin_policy policy,
+            const int *expected)
+{
+    for (int i = 0; i < topo->num_cpus; i++) {
+        CHECK(cpu_topology_select(topo, policy, i) == expected[i]);
+        /* Wraps around */
+        CHECK(cpu_topology_select(topo, policy, i + topo->num_cpus) ==
+              expected[i]);
+    }
+}
+
+static void
+test_full(void)
+{
+    static const int compact[FULL_CPUS] = {
+        0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15
+    };
+    static const int cores[FULL_CPUS] = {
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+    };
+    static const int scatter[FULL_CPUS] = {
+        0, 4, 1, 5, 2, 6, 3, 7, 8, 12, 9, 13, 10, 14, 11, 15
+    };
+    struct cpu_topology *topo;
+    const struct cpu_cache *cache;
+
+    make_root();
+    write_full_tree();
+    topo = cpu_topology_create_from(root);
+    cpu_topology_print(topo, stdout);
+
+    CHECK(topo->num_cpus == FULL_CPUS);
+    CHECK(topo->num_cores == 8);
+    CHECK(topo->num_packages == 2);
+    CHECK(topo->num_nodes == 2);
+    for (int i = 0; i < topo->num_cpus && i < FULL_CPUS; i++) {
+        const struct cpu_info *info = &topo->cpus[i];
+        CHECK(info->cpu == i);
+        CHECK(info->core == i % 8);
+        CHECK(info->smt == i / 8);
+        CHECK(info->package == i % 8 / 4);
+        CHECK(info->node == info->package);
+    }
+
+    CHECK(topo->num_caches == 4);
+    cache = cpu_topology_cache(topo, 1);
+    CHECK(cache && cache->type == CPU_CACHE_DATA &&
+          cache->size == 32 << 10 && cache->line_size == 64 &&
+          cache->shared == 2);
+    cache = cpu_topology_cache(topo, 2);
+    CHECK(cache && cache->size == 1 << 20 && cache->shared == 2);
+    cache = cpu_topology_cache(topo, 3);
+    CHECK(cache && cache->size == 16 << 20 && cache->shared == 8);
+    CHECK(!cpu_topology_cache(topo, 4));
+
+    check_order(topo, CPU_PIN_COMPACT, compact);
+    check_order(topo, CPU_PIN_CORES, cores);
+    check_order(topo, CPU_PIN_SCATTER, scatter);
+
+    cpu_topology_destroy(topo);
+    remove_root();
+}
+
+/* Gaps in the online CPUs. CPUs 0-3 have "core_id" but no sibling lists,
+ * so siblings are found by "core_id" and package. CPUs 6 and 7 have no
+ * topology at all. Only CPU 2 links to its node, the others are found in
+ * the node lists, or default to node 0. No caches. */
+static void
+test_partial(void)
+{
+    static const int online[] = { 0, 1, 2, 3, 6, 7 };
+    static const int compact[] = { 0, 1, 2, 3, 7, 6 };
+    static const int cores[] = { 0, 2, 7, 6, 1, 3 };
+    static const int scatter[] = { 0, 6, 2, 7, 1, 3 };
+    static const int expected_cores[] = { 0, 0, 1, 1, 2, 3 };
+    static const int expected_smt[] = { 0, 1, 0, 1, 0, 0 };
+    static const int expected_nodes[] = { 0, 0, 0, 0, 1, 0 };
+    struct cpu_topology *topo;
+
+    make_root();
+    write_file("0-3,6-7", "cpu/online");
+    for (int cpu = 0; cpu < 4; cpu++) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d", cpu / 2);
+        write_file(buf, "cpu/cpu%d/topology/core_id", cpu);
+    }
+    write_file(NULL, "cpu/cpu2/node0");
+    write_file("6", "node/node1/cpulist");
+    write_file("", "node/node0/cpulist");
+
+    topo = cpu_topology_create_from(root);
+    cpu_topology_print(topo, stdout);
+
+    CHECK(topo->num_cpus == 6);
+    CHECK(topo->num_cores == 4);
+    CHECK(topo->num_packages == 1);
+    CHECK(topo->num_nodes == 2);
+    for (int i = 0; i < topo->num_cpus && i < 6; i++) {
+        const struct cpu_info *info = &topo->cpus[i];
+        CHECK(info->cpu == online[i]);
+        CHECK(info->core == expected_cores[i]);
+        CHECK(info->smt == expected_smt[i]);
+        CHECK(info->node == expected_nodes[i]);
+        CHECK(info->package == 0);
+    }
+    /* Caches fall back to sysconf */
+    for (int i = 0; i < topo->num_caches; i++) {
+        CHECK(topo->caches[i].level >= 1 && topo->caches[i].level <= 3);
+    }
+
+    check_order(topo, CPU_PIN_COMPACT, compact);
+    check_order(topo, CPU_PIN_CORES, cores);
+    check_order(topo, CPU_PIN_SCATTER, scatter);
+
+    cpu_topology_destroy(topo);
+    remove_root();
+}
+
+/* No sysfs at all: online CPUs as independent cores */
+static void
+test_empty(void)
+{
+    struct cpu_topology *topo;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    make_root();
+    topo = cpu_topology_create_from(root);
+
+    CHECK(topo->num_cpus == MAX(online, 1));
+    CHECK(topo->num_cores == topo->num_cpus);
+    CHECK(topo->num_packages == 1);
+    CHECK(topo->num_nodes == 1);
+    for (int p = 0; p < CPU_PIN_POLICIES; p++) {
+        for (int i = 0; i < topo->num_cpus; i++) {
+            CHECK(cpu_topology_select(topo, p, i) == i);
+        }
+    }
+
+    cpu_topology_destroy(topo);
+    remove_root();
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse arguments */
+    for (int i=0; i<argc; i++) {
+        if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i])) {
+            printf("Tests cpu_topology on fake sysfs trees.\n"
+                   "Usage: %s\n"
+                   "Reads a full tree with SMT and two NUMA nodes, a "
+                   "partial tree, and an empty one, from a temporary "
+                   "directory.\n",
+                   argv[0]);
+            exit(1);
+        }
+    }
+
+    test_full();
+    test_partial();
+    test_empty();
+
+    /* Check for correctness errors */
+    if (error) {
+        printf("Error: correctness issue\n");
+    }
+
+    return error;
+}
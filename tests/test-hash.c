@@ -0,0 +1,585 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "lib/util.h"
+#include "lib/hash.h"
+#include "lib/perf.h"
+#include "lib/random.h"
+#include "lib/cpu-features.h"
+#include "lib/hash-batch.h"
+
+#define DEFAULT_MILLISECONDS 20
+#define MIN_KEY_SIZE 4
+#define MAX_KEY_SIZE 4096
+
+/* Keys are hashed from a buffer larger than L1 would need, so consecutive
+ * calls do not hash the same bytes */
+#define KEY_BUFFER_SIZE (64 * 1024)
+
+/* Calls between clock reads */
+#define BATCH 256
+
+/* A byte hash function under test */
+struct bytes_func {
+    const char *name;
+    uint32_t (*func)(const void *, size_t, uint32_t);
+};
+
+static uint32_t
+hash64_bytes_(const void *p, size_t n, uint32_t basis)
+{
+    return hash64_bytes(p, n, basis);
+}
+
+/* The basis is used as the key, so that calls still depend on each other */
+static uint32_t
+siphash_(const void *p, size_t n, uint32_t basis)
+{
+    struct hash_key key = { basis, 0 };
+    return hash_siphash(p, n, &key);
+}
+
+static const struct bytes_func bytes_funcs[] = {
+    { "generic", hash_bytes_generic },
+#ifdef HASH_HAVE_CRC32C
+    { "crc32c", hash_bytes_crc32c },
+#endif
+    { "hash_bytes", hash_bytes },
+    { "hash64_bytes", hash64_bytes_ },
+    { "siphash", siphash_ },
+};
+
+/* Keys per call of the batch functions */
+#define BATCH_KEYS 1024
+
+/* Quality checks. The keys of the distribution and collision checks are
+ * fixed, so their results are deterministic; the avalanche check draws
+ * random keys, and its limit leaves room for sampling noise. */
+#define QUALITY_KEYS (64 * 1024)
+#define QUALITY_MAX_KEY_SIZE 16
+#define AVALANCHE_KEYS 4096
+#define AVALANCHE_MAX_BIAS 0.05     /* Of a flip probability of 0.5 */
+#define CHI_SQUARE_BUCKETS 1024     /* Low bits, as used by the maps */
+#define CHI_SQUARE_MAX_Z 6.0        /* Standard deviations over the mean */
+#define MAX_COLLISIONS 8            /* About 0.5 are expected */
+
+/* A hash function of fixed-size keys under quality checks, with "bits"
+ * output bits */
+struct quality_func {
+    const char *name;
+    size_t size;
+    int bits;
+    uint64_t (*func)(const void *);
+};
+
+static uint64_t
+quality_hash_int(const void *p)
+{
+    uint32_t x;
+    memcpy(&x, p, sizeof x);
+    return hash_int(x, 0);
+}
+
+static uint64_t
+quality_hash_uint64(const void *p)
+{
+    uint64_t x;
+    memcpy(&x, p, sizeof x);
+    return hash_uint64(x);
+}
+
+static uint64_t
+quality_hash_bytes(const void *p)
+{
+    return hash_bytes(p, QUALITY_MAX_KEY_SIZE, 0);
+}
+
+static uint64_t
+quality_hash_words(const void *p)
+{
+    uint32_t words[QUALITY_MAX_KEY_SIZE / 4];
+    memcpy(words, p, sizeof words);
+    return hash_words(words, QUALITY_MAX_KEY_SIZE / 4, 0);
+}
+
+static uint64_t
+quality_hash64_uint64(const void *p)
+{
+    uint64_t x;
+    memcpy(&x, p, sizeof x);
+    return hash64_uint64(x, 0);
+}
+
+static uint64_t
+quality_hash64_bytes(const void *p)
+{
+    return hash64_bytes(p, QUALITY_MAX_KEY_SIZE, 0);
+}
+
+static const struct quality_func quality_funcs[] = {
+    { "hash_int", 4, 32, quality_hash_int },
+    { "hash_uint64", 8, 32, quality_hash_uint64 },
+    { "hash_bytes", QUALITY_MAX_KEY_SIZE, 32, quality_hash_bytes },
+    { "hash_words", QUALITY_MAX_KEY_SIZE, 32, quality_hash_words },
+    { "hash64_uint64", 8, 64, quality_hash64_uint64 },
+    { "hash64_bytes", QUALITY_MAX_KEY_SIZE, 64, quality_hash64_bytes },
+};
+
+static uint8_t keys[KEY_BUFFER_SIZE + MAX_KEY_SIZE];
+static volatile uint32_t sink;
+static bool error;
+
+/* Returns throughput in GB/s of hashing keys of "size" bytes */
+static double
+bench_bytes(const struct bytes_func *f, size_t size, int milliseconds)
+{
+    uint64_t start, elapsed, bytes = 0;
+    uint64_t limit = milliseconds * 1000000ULL;
+    size_t offset = 0;
+    uint32_t hash = 0;
+
+    start = get_time_ns();
+    do {
+        for (int i = 0; i < BATCH; i++) {
+            hash ^= f->func(&keys[offset], size, hash);
+            offset = (offset + size) & (KEY_BUFFER_SIZE - 1);
+        }
+        bytes += BATCH * size;
+        elapsed = get_time_ns() - start;
+    } while (elapsed < limit);
+
+    sink = hash;
+    return (double)bytes / elapsed;
+}
+
+/* The result must not depend on alignment */
+static void
+check_bytes(const struct bytes_func *f)
+{
+    static uint8_t copy[MAX_KEY_SIZE + 8];
+
+    for (size_t size = 0; size <= 100; size++) {
+        uint32_t expected = f->func(keys, size, 0x1234);
+        for (int offset = 1; offset < 8; offset++) {
+            memcpy(&copy[offset], keys, size);
+            if (f->func(&copy[offset], size, 0x1234) != expected) {
+                printf("Error: %s depends on alignment (size %zu)\n",
+                       f->name, size);
+                error = true;
+                return;
+            }
+        }
+    }
+}
+
+/* SipHash-1-3 of the messages 00 01 02 ... of "size" bytes, under the key
+ * 00 01 ... 0f, as computed by the reference algorithm */
+static const struct {
+    size_t size;
+    uint64_t hash;
+} siphash_vectors[] = {
+    { 0, 0xabac0158050fc4dcULL },
+    { 1, 0xc9f49bf37d57ca93ULL },
+    { 7, 0xd3927d989bb11140ULL },
+    { 8, 0x369095118d299a8eULL },
+    { 15, 0xd320d86d2a519956ULL },
+    { 16, 0xcc4fdd1a7d908b66ULL },
+    { 63, 0x9d199062b7bbb3a8ULL },
+};
+
+static void
+check_siphash(void)
+{
+    uint8_t key_bytes[16], message[64];
+    struct hash_key key;
+
+    for (int i = 0; i < 64; i++) {
+        message[i] = i;
+        if (i < 16) {
+            key_bytes[i] = i;
+        }
+    }
+    memcpy(&key.k0, key_bytes, 8);
+    memcpy(&key.k1, key_bytes + 8, 8);
+
+    for (size_t i = 0; i < sizeof(siphash_vectors) / sizeof(*siphash_vectors);
+         i++) {
+        uint64_t hash = hash_siphash(message, siphash_vectors[i].size, &key);
+        if (hash != siphash_vectors[i].hash) {
+            printf("Error: siphash of %zu bytes is %016lx, expected %016lx\n",
+                   siphash_vectors[i].size, hash, siphash_vectors[i].hash);
+            error = true;
+        }
+    }
+}
+
+/* Hashing a key in random pieces must give the same result as hashing it
+ * at once */
+static void
+check_hasher(void)
+{
+    for (size_t size = 0; size <= 200; size++) {
+        uint32_t basis = random_uint32();
+        uint32_t expected = hash_bytes(keys, size, basis);
+        struct hasher hasher;
+        size_t offset = 0;
+
+        hasher_init(&hasher, basis);
+        while (offset < size) {
+            size_t piece = random_uint32() % 13;
+            piece = MIN(piece, size - offset);
+            if (piece == 4) {
+                uint32_t x;
+                memcpy(&x, &keys[offset], 4);
+                hasher_update_u32(&hasher, x);
+            } else if (piece == 8) {
+                uint64_t x;
+                memcpy(&x, &keys[offset], 8);
+                hasher_update_u64(&hasher, x);
+            } else {
+                hasher_update_bytes(&hasher, &keys[offset], piece);
+            }
+            offset += piece;
+        }
+        if (hasher_finish(&hasher) != expected) {
+            printf("Error: hasher differs from hashing %zu bytes at once\n",
+                   size);
+            error = true;
+            return;
+        }
+    }
+}
+
+/* Batch kernels, including those the dispatcher would not pick */
+struct batch_kernel {
+    const char *name;
+    uint32_t features;
+    void (*int_batch)(const uint32_t *, uint32_t *, size_t, uint32_t);
+    void (*uint64_batch)(const uint64_t *, uint32_t *, size_t, uint32_t);
+};
+
+static const struct batch_kernel batch_kernels[] = {
+    { "dispatch", 0, hash_int_batch, hash_uint64_batch },
+#ifdef HASH_BATCH_KERNELS
+    { "avx2", CPU_FEATURE_AVX2, hash_int_batch_avx2,
+      hash_uint64_batch_avx2 },
+    { "avx", CPU_FEATURE_AVX, hash_int_batch_avx, hash_uint64_batch_avx },
+    { "sse", 0, hash_int_batch_sse, hash_uint64_batch_sse },
+#endif
+};
+
+/* Batch results must be identical to the scalar functions, for any
+ * number of keys, with every kernel the CPU supports */
+static void
+check_batch(const struct batch_kernel *k)
+{
+    const uint32_t *in32 = (const uint32_t *)keys;
+    const uint64_t *in64 = (const uint64_t *)keys;
+    uint32_t out[BATCH_KEYS];
+    uint32_t basis = random_uint32();
+
+    if (!cpu_has(k->features)) {
+        return;
+    }
+    for (size_t n = 0; n <= BATCH_KEYS; n += n < 64 ? 1 : 61) {
+        k->int_batch(in32, out, n, basis);
+        for (size_t i = 0; i < n; i++) {
+            if (out[i] != hash_int(in32[i], basis)) {
+                printf("Error: %s hash_int_batch differs at %zu of %zu\n",
+                       k->name, i, n);
+                error = true;
+                return;
+            }
+        }
+        k->uint64_batch(in64, out, n, basis);
+        for (size_t i = 0; i < n; i++) {
+            if (out[i] != hash_uint64_basis(in64[i], basis)) {
+                printf("Error: %s hash_uint64_batch differs at %zu of %zu\n",
+                       k->name, i, n);
+                error = true;
+                return;
+            }
+        }
+    }
+}
+
+/* Returns the largest deviation from 0.5 of the probability that flipping
+ * an input bit flips an output bit, over all pairs of bits */
+static double
+check_avalanche(const struct quality_func *f)
+{
+    static uint32_t flips[QUALITY_MAX_KEY_SIZE * 8][64];
+    uint8_t key[QUALITY_MAX_KEY_SIZE];
+    size_t bits = f->size * 8;
+    double max_bias = 0;
+
+    memset(flips, 0, sizeof flips);
+    for (int k = 0; k < AVALANCHE_KEYS; k++) {
+        random_bytes(key, f->size);
+        uint64_t hash = f->func(key);
+        for (size_t i = 0; i < bits; i++) {
+            key[i / 8] ^= 1 << (i % 8);
+            uint64_t diff = f->func(key) ^ hash;
+            key[i / 8] ^= 1 << (i % 8);
+            for (int j = 0; j < f->bits; j++) {
+                flips[i][j] += (diff >> j) & 1;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < bits; i++) {
+        for (int j = 0; j < f->bits; j++) {
+            double bias = (double)flips[i][j] / AVALANCHE_KEYS - 0.5;
+            bias = bias < 0 ? -bias : bias;
+            max_bias = bias > max_bias ? bias : max_bias;
+        }
+    }
+    if (max_bias > AVALANCHE_MAX_BIAS) {
+        printf("Error: %s fails avalanche, bias %.3lf\n", f->name, max_bias);
+        error = true;
+    }
+    return max_bias;
+}
+
+/* Writes the "i"-th key: "i" in the lowest bytes for sequential keys, or
+ * in the two highest bytes for sparse keys, all other bytes zero */
+static void
+quality_key(const struct quality_func *f, uint32_t i, bool sparse,
+            uint8_t *key)
+{
+    uint16_t x = i;
+
+    memset(key, 0, f->size);
+    if (sparse) {
+        memcpy(&key[f->size - sizeof x], &x, sizeof x);
+    } else {
+        memcpy(key, &x, sizeof x);
+    }
+}
+
+static int
+compare_uint64(const void *a_, const void *b_)
+{
+    uint64_t a = *(const uint64_t *)a_;
+    uint64_t b = *(const uint64_t *)b_;
+    return a < b ? -1 : a > b;
+}
+
+/* Returns how many standard deviations the chi-square of the bucket counts
+ * of "hashes", by their bits from "shift" up, is above its mean */
+static double
+chi_square_z(const uint64_t *hashes, int shift)
+{
+    static uint32_t buckets[CHI_SQUARE_BUCKETS];
+    double expected = (double)QUALITY_KEYS / CHI_SQUARE_BUCKETS;
+    double chi_square = 0;
+    int dof = CHI_SQUARE_BUCKETS - 1;
+
+    memset(buckets, 0, sizeof buckets);
+    for (int i = 0; i < QUALITY_KEYS; i++) {
+        buckets[(hashes[i] >> shift) & (CHI_SQUARE_BUCKETS - 1)]++;
+    }
+    for (int b = 0; b < CHI_SQUARE_BUCKETS; b++) {
+        double d = buckets[b] - expected;
+        chi_square += d * d / expected;
+    }
+    return (chi_square - dof) / sqrt(2.0 * dof);
+}
+
+/* Hashes QUALITY_KEYS keys, then returns how many standard deviations the
+ * chi-square of their bucket counts is above its mean, and sets
+ * "collisions" to the number of keys whose full hash equals that of an
+ * earlier key. For 64-bit hashes, buckets by the high half too, and
+ * returns the worse of the two. */
+static double
+check_distribution(const struct quality_func *f, bool sparse,
+                   int *collisions)
+{
+    static uint64_t hashes[QUALITY_KEYS];
+    uint8_t key[QUALITY_MAX_KEY_SIZE];
+    double z;
+
+    for (uint32_t i = 0; i < QUALITY_KEYS; i++) {
+        quality_key(f, i, sparse, key);
+        hashes[i] = f->func(key);
+    }
+    z = chi_square_z(hashes, 0);
+    if (f->bits == 64) {
+        z = MAX(z, chi_square_z(hashes, 32));
+    }
+
+    qsort(hashes, QUALITY_KEYS, sizeof *hashes, compare_uint64);
+    *collisions = 0;
+    for (int i = 1; i < QUALITY_KEYS; i++) {
+        *collisions += hashes[i] == hashes[i - 1];
+    }
+
+    if (z > CHI_SQUARE_MAX_Z) {
+        printf("Error: %s distributes %s keys unevenly, chi-square z %.1lf\n",
+               f->name, sparse ? "sparse" : "sequential", z);
+        error = true;
+    }
+    if (*collisions > MAX_COLLISIONS) {
+        printf("Error: %s has %d collisions on %s keys\n", f->name,
+               *collisions, sparse ? "sparse" : "sequential");
+        error = true;
+    }
+    return z;
+}
+
+static void
+check_quality(void)
+{
+    int num_funcs = sizeof(quality_funcs) / sizeof(*quality_funcs);
+
+    printf("\n%-14s %-12s %-12s %-12s %-12s %-12s\n", "function",
+           "avalanche", "chi2 seq", "coll seq", "chi2 sparse", "coll sparse");
+    for (int f = 0; f < num_funcs; f++) {
+        const struct quality_func *func = &quality_funcs[f];
+        int seq_collisions, sparse_collisions;
+        double bias = check_avalanche(func);
+        double seq_z = check_distribution(func, false, &seq_collisions);
+        double sparse_z = check_distribution(func, true, &sparse_collisions);
+
+        printf("%-14s %-12.3lf %-12.1lf %-12d %-12.1lf %-12d\n", func->name,
+               bias, seq_z, seq_collisions, sparse_z, sparse_collisions);
+    }
+}
+
+/* Returns throughput in millions of keys per second of the keyed hash */
+static double
+bench_siphash_uint64(int milliseconds)
+{
+    const uint64_t *in64 = (const uint64_t *)keys;
+    uint64_t limit = milliseconds * 1000000ULL;
+    uint64_t start, elapsed, count = 0;
+    struct hash_key key;
+    uint64_t hash = 0;
+
+    hash_key_init_random(&key);
+    start = get_time_ns();
+    do {
+        for (int i = 0; i < BATCH_KEYS; i++) {
+            hash ^= hash_siphash_uint64(in64[i], &key);
+        }
+        count += BATCH_KEYS;
+        elapsed = get_time_ns() - start;
+    } while (elapsed < limit);
+
+    sink = hash;
+    return count * 1e3 / elapsed;
+}
+
+/* Returns throughput in millions of keys per second */
+static double
+bench_ints(bool batch, bool wide, int milliseconds)
+{
+    const uint32_t *in32 = (const uint32_t *)keys;
+    const uint64_t *in64 = (const uint64_t *)keys;
+    uint64_t limit = milliseconds * 1000000ULL;
+    uint64_t start, elapsed, count = 0;
+    uint32_t out[BATCH_KEYS];
+
+    start = get_time_ns();
+    do {
+        if (batch && wide) {
+            hash_uint64_batch(in64, out, BATCH_KEYS, 0);
+        } else if (batch) {
+            hash_int_batch(in32, out, BATCH_KEYS, 0);
+        } else {
+            for (int i = 0; i < BATCH_KEYS; i++) {
+                out[i] = wide ? hash_uint64_basis(in64[i], 0)
+                              : hash_int(in32[i], 0);
+            }
+        }
+        sink = out[count % BATCH_KEYS];
+        count += BATCH_KEYS;
+        elapsed = get_time_ns() - start;
+    } while (elapsed < limit);
+
+    return count * 1e3 / elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse arguments */
+    for (int i=0; i<argc; i++) {
+        if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i])) {
+            printf("Benchmarks hash functions over key sizes %d-%d bytes, and\n"
+                   "checks avalanche, bucket distribution and collisions.\n"
+                   "Usage: %s [MILLISECONDS]\n"
+                   "Defaults: %d milliseconds per function and size.\n",
+                   MIN_KEY_SIZE, MAX_KEY_SIZE, argv[0],
+                   DEFAULT_MILLISECONDS);
+            exit(1);
+        }
+    }
+    int milliseconds = argc >=2 ? atoi(argv[1]) : DEFAULT_MILLISECONDS;
+    int num_funcs = sizeof(bytes_funcs) / sizeof(*bytes_funcs);
+
+    random_bytes(keys, sizeof(keys));
+    cpu_features_print(stdout);
+    printf("hash_bytes uses %s, batch functions use %s\n",
+           hash_bytes_impl_name(), hash_batch_impl_name());
+
+    for (int f=0; f<num_funcs; f++) {
+#ifdef HASH_HAVE_CRC32C
+        if (bytes_funcs[f].func == hash_bytes_crc32c &&
+            !cpu_has(CPU_FEATURE_SSE4_2)) {
+            continue;
+        }
+#endif
+        check_bytes(&bytes_funcs[f]);
+    }
+
+    printf("%-10s", "bytes");
+    for (int f=0; f<num_funcs; f++) {
+        printf(" %-12s", bytes_funcs[f].name);
+    }
+    printf("   (GB/s)\n");
+
+    for (size_t size=MIN_KEY_SIZE; size<=MAX_KEY_SIZE; size*=2) {
+        printf("%-10zu", size);
+        for (int f=0; f<num_funcs; f++) {
+#ifdef HASH_HAVE_CRC32C
+            if (bytes_funcs[f].func == hash_bytes_crc32c &&
+                !cpu_has(CPU_FEATURE_SSE4_2)) {
+                printf(" %-12s", "-");
+                continue;
+            }
+#endif
+            printf(" %-12.2lf", bench_bytes(&bytes_funcs[f], size,
+                                            milliseconds));
+            fflush(stdout);
+        }
+        printf("\n");
+    }
+
+    check_siphash();
+    check_hasher();
+    for (size_t k = 0; k < sizeof(batch_kernels) / sizeof(*batch_kernels);
+         k++) {
+        check_batch(&batch_kernels[k]);
+    }
+    check_quality();
+    printf("\n%-20s %-12s %-12s   (Mkeys/s)\n", "function", "scalar",
+           "batch");
+    printf("%-20s %-12.2lf %-12.2lf\n", "hash_int",
+           bench_ints(false, false, milliseconds),
+           bench_ints(true, false, milliseconds));
+    printf("%-20s %-12.2lf %-12.2lf\n", "hash_uint64_basis",
+           bench_ints(false, true, milliseconds),
+           bench_ints(true, true, milliseconds));
+    printf("%-20s %-12.2lf %-12s\n", "hash_siphash_uint64",
+           bench_siphash_uint64(milliseconds), "-");
+
+    /* Check for correctness errors */
+    if (error) {
+        printf("Error: correctness issue\n");
+    }
+
+    return error;
+}
@@ -0,0 +1,199 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lib/util.h"
+#include "lib/list.h"
+#include "lib/random.h"
+#include "lib/perf.h"
+
+#define DEFAULT_SEED 1
+#define MAX_ELEMENTS 100001
+
+struct element {
+    struct list node;
+    int key;
+    int seq;            /* Position before sorting, checks stability */
+};
+
+static bool error;
+static struct element elements[MAX_ELEMENTS];
+
+/* Counts comparisons in "aux" */
+static int
+compare_elements(const struct list *a_, const struct list *b_, void *aux)
+{
+    const struct element *a = CONTAINER_OF(a_, struct element, node);
+    const struct element *b = CONTAINER_OF(b_, struct element, node);
+
+    (*(size_t*)aux)++;
+    return (a->key > b->key) - (a->key < b->key);
+}
+
+/* Reference order of a stable sort */
+static int
+compare_stable(const void *a_, const void *b_)
+{
+    const struct element *a = *(const struct element**)a_;
+    const struct element *b = *(const struct element**)b_;
+
+    if (a->key != b->key) {
+        return a->key < b->key ? -1 : 1;
+    }
+    return (a->seq > b->seq) - (a->seq < b->seq);
+}
+
+/* Checks that "list" holds exactly "expected", in order, with consistent
+ * links in both directions */
+static void
+check(struct list *list, struct element **expected, size_t n)
+{
+    struct element *e;
+    size_t i = 0;
+
+    if (list_size(list) != n) {
+        error = true;
+        return;
+    }
+    LIST_FOR_EACH (e, node, list) {
+        if (e != expected[i++]) {
+            error = true;
+        }
+    }
+    LIST_FOR_EACH_REVERSE (e, node, list) {
+        if (e != expected[--i]) {
+            error = true;
+        }
+    }
+}
+
+/* Builds a list of elements "first" to "first" + "n" - 1 with keys in
+ * [0, "range"), sorted if "sorted". Sets "refs" to them in stable order. */
+static void
+build(struct list *list, struct element **refs, size_t first, size_t n,
+      int range, bool sorted)
+{
+    struct element *e;
+
+    list_init(list);
+    for (size_t i = 0; i < n; i++) {
+        e = &elements[first + i];
+        e->key = random_range(range);
+        e->seq = first + i;
+        refs[i] = e;
+    }
+    qsort(refs, n, sizeof(*refs), compare_stable);
+    for (size_t i = 0; i < n; i++) {
+        list_push_back(list, sorted ? &refs[i]->node
+                                    : &elements[first + i].node);
+    }
+}
+
+static int
+log2_ceil(size_t n)
+{
+    int log = 0;
+    while (((size_t)1 << log) < n) {
+        log++;
+    }
+    return log;
+}
+
+/* Returns the number of comparisons */
+static size_t
+test_sort(size_t n, int range)
+{
+    struct element **refs = xmalloc(sizeof(*refs) * MAX(n, 1));
+    size_t comparisons = 0;
+    size_t again = 0;
+    struct list list;
+
+    build(&list, refs, 0, n, range, false);
+    list_sort(&list, compare_elements, &comparisons);
+    check(&list, refs, n);
+    if (comparisons > n * log2_ceil(n)) {
+        error = true;
+    }
+
+    /* Sorting again must keep the order */
+    list_sort(&list, compare_elements, &again);
+    check(&list, refs, n);
+
+    free(refs);
+    return comparisons;
+}
+
+/* Merges a sorted list of "m" elements into one of "n". On ties, elements
+ * of the destination come first, so building both from consecutive
+ * elements gives the same result as a stable sort of all of them. */
+static void
+test_merge(size_t n, size_t m, int range)
+{
+    struct element **refs = xmalloc(sizeof(*refs) * MAX(n + m, 1));
+    size_t comparisons = 0;
+    struct list dst, src;
+
+    build(&dst, refs, 0, n, range, true);
+    build(&src, refs + n, n, m, range, true);
+    qsort(refs, n + m, sizeof(*refs), compare_stable);
+
+    list_merge(&dst, &src, compare_elements, &comparisons);
+    check(&dst, refs, n + m);
+    if (!list_is_empty(&src) || comparisons > 2 * (n + m)) {
+        error = true;
+    }
+    free(refs);
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse arguments */
+    for (int i=0; i<argc; i++) {
+        if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i])) {
+            printf("Tests correctness of list_sort and list_merge.\n"
+                   "Usage: %s [SEED]\n"
+                   "Sorts and merges lists of up to %d elements with "
+                   "distinct and repeated keys.\n"
+                   "Defaults: seed %d.\n",
+                   argv[0], MAX_ELEMENTS, DEFAULT_SEED);
+            exit(1);
+        }
+    }
+    int seed = argc >=2 ? atoi(argv[1]) : DEFAULT_SEED;
+    random_set_seed(seed);
+
+    static const size_t sizes[] = { 0, 1, 2, 3, 5, 7, 8, 9, 31, 33, 1000,
+                                    1001, MAX_ELEMENTS };
+    static const int ranges[] = { 1, 4, 1 << 30 };
+    size_t num_sizes = sizeof(sizes) / sizeof(*sizes);
+    size_t num_ranges = sizeof(ranges) / sizeof(*ranges);
+    uint64_t start;
+
+    printf("%-10s %-12s %-14s %-10s\n",
+           "elements", "key range", "comparisons", "ms");
+    for (size_t s=0; s<num_sizes; s++) {
+        for (size_t r=0; r<num_ranges; r++) {
+            start = get_time_ns();
+            size_t comparisons = test_sort(sizes[s], ranges[r]);
+            printf("%-10zu %-12d %-14zu %-10.2lf\n", sizes[s], ranges[r],
+                   comparisons, (get_time_ns() - start) / 1e6);
+        }
+    }
+
+    /* Merges of all size pairs, except the largest */
+    for (size_t s=0; s<num_sizes-1; s++) {
+        for (size_t t=0; t<num_sizes-1; t++) {
+            for (size_t r=0; r<num_ranges; r++) {
+                test_merge(sizes[s], sizes[t], ranges[r]);
+            }
+        }
+    }
+
+    /* Check for correctness errors */
+    if (error) {
+        printf("Error: correctness issue\n");
+    }
+
+    return error;
+}
@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "lib/util.h"
+#include "lib/locks.h"
+#include "lib/perf.h"
+
+#define DEFAULT_MILLISECONDS 250
+#define DEFAULT_THREADS 4
+#define MAX_THREADS 64
+
+/* Iterations of private work between critical sections */
+#define OUTSIDE_WORK 16
+
+/* Reader-writer locks write once every WRITE_EVERY critical sections */
+#define WRITE_EVERY 8
+
+/* A lock implementation under test. "read" is NULL for exclusive locks,
+ * otherwise it reads the shared record under a read lock and returns false
+ * if it was torn. */
+struct lock_ops {
+    const char *name;
+    void (*init)(void);
+    void (*destroy)(void);
+    void (*lock)(void);
+    void (*unlock)(void);
+    bool (*read)(void);
+};
+
+static struct spinlock spin;
+static struct mutex mutex;
+static struct fmutex fmutex;
+static struct ticketlock ticket;
+static struct mcslock mcs;
+static __thread struct mcs_node mcs_node;
+static struct rwlock rw;
+static struct brlock br;
+static struct seqlock seq;
+
+/* Protected by the lock under test. Atomic only so that seqlock readers
+ * may load it while a writer changes it. */
+static struct {
+    atomic_ulong counter;
+    atomic_ulong shadow;
+} shared CACHE_ALIGNED;
+
+static bool
+shared_consistent(void)
+{
+    return atomic_load_explicit(&shared.counter, memory_order_relaxed) ==
+           atomic_load_explicit(&shared.shadow, memory_order_relaxed);
+}
+
+static void spin_init(void) { spinlock_init(&spin); }
+static void spin_destroy(void) { spinlock_destroy(&spin); }
+static void spin_lock(void) { spinlock_lock(&spin); }
+static void spin_unlock(void) { spinlock_unlock(&spin); }
+
+static void mutex_init_(void) { mutex_init(&mutex); }
+static void mutex_destroy_(void) { mutex_destroy(&mutex); }
+static void mutex_lock_(void) { mutex_lock(&mutex); }
+static void mutex_unlock_(void) { mutex_unlock(&mutex); }
+
+static void fmutex_init_(void) { fmutex_init(&fmutex); }
+static void fmutex_destroy_(void) { fmutex_destroy(&fmutex); }
+static void fmutex_lock_(void) { fmutex_lock(&fmutex); }
+static void fmutex_unlock_(void) { fmutex_unlock(&fmutex); }
+
+static void ticket_init(void) { ticketlock_init(&ticket); }
+static void ticket_destroy(void) { ticketlock_destroy(&ticket); }
+static void ticket_lock(void) { ticketlock_lock(&ticket); }
+static void ticket_unlock(void) { ticketlock_unlock(&ticket); }
+
+static void mcs_init(void) { mcslock_init(&mcs); }
+static void mcs_destroy(void) { mcslock_destroy(&mcs); }
+static void mcs_lock(void) { mcslock_lock(&mcs, &mcs_node); }
+static void mcs_unlock(void) { mcslock_unlock(&mcs, &mcs_node); }
+
+static void rw_init(void) { rwlock_init(&rw); }
+static void rw_destroy(void) { rwlock_destroy(&rw); }
+static void rw_lock(void) { rwlock_write_lock(&rw); }
+static void rw_unlock(void) { rwlock_write_unlock(&rw); }
+
+static bool
+rw_read(void)
+{
+    bool ok;
+
+    rwlock_read_lock(&rw);
+    ok = shared_consistent();
+    rwlock_read_unlock(&rw);
+    return ok;
+}
+
+static void br_init(void) { brlock_init(&br, 0); }
+static void br_destroy(void) { brlock_destroy(&br); }
+static void br_lock(void) { brlock_write_lock(&br); }
+static void br_unlock(void) { brlock_write_unlock(&br); }
+
+static bool
+br_read(void)
+{
+    unsigned int slot = brlock_read_lock(&br);
+    bool ok = shared_consistent();
+
+    brlock_read_unlock(&br, slot);
+    return ok;
+}
+
+static void seq_init(void) { seqlock_init(&seq); }
+static void seq_destroy(void) { seqlock_destroy(&seq); }
+static void seq_lock(void) { seqlock_write_lock(&seq); }
+static void seq_unlock(void) { seqlock_write_unlock(&seq); }
+
+/* Torn reads are allowed only if the sequence tells to retry */
+static bool
+seq_read(void)
+{
+    uint32_t begin;
+    bool ok;
+
+    do {
+        begin = seqlock_read_begin(&seq);
+        ok = shared_consistent();
+    } while (seqlock_read_retry(&seq, begin));
+    return ok;
+}
+
+static const struct lock_ops locks[] = {
+    { "spinlock", spin_init, spin_destroy, spin_lock, spin_unlock, NULL },
+    { "mutex", mutex_init_, mutex_destroy_, mutex_lock_, mutex_unlock_,
+      NULL },
+    { "fmutex", fmutex_init_, fmutex_destroy_, fmutex_lock_,
+      fmutex_unlock_, NULL },
+    { "ticket", ticket_init, ticket_destroy, ticket_lock, ticket_unlock,
+      NULL },
+    { "mcs", mcs_init, mcs_destroy, mcs_lock, mcs_unlock, NULL },
+    { "rwlock", rw_init, rw_destroy, rw_lock, rw_unlock, rw_read },
+    { "brlock", br_init, br_destroy, br_lock, br_unlock, br_read },
+    { "seqlock", seq_init, seq_destroy, seq_lock, seq_unlock, seq_read },
+};
+
+static const struct lock_ops *ops;
+static volatile bool running;
+static volatile bool error;
+
+static atomic_ulong total_ops;
+static atomic_ulong total_writes;
+
+static void*
+worker(void *args)
+{
+    volatile uint64_t local = (uintptr_t)args;
+    uint64_t count = 0;
+    uint64_t writes = 0;
+    uint64_t value;
+
+    while (running) {
+        /* Readers must never see the two writes below apart */
+        if (ops->read && (count + (uintptr_t)args) % WRITE_EVERY) {
+            if (!ops->read()) {
+                error = true;
+            }
+            count++;
+            continue;
+        }
+        ops->lock();
+        /* Two writes that a broken lock would let other threads tear */
+        value = atomic_load_explicit(&shared.counter, memory_order_relaxed);
+        atomic_store_explicit(&shared.counter, value + 1,
+                              memory_order_relaxed);
+        atomic_store_explicit(&shared.shadow, value + 1,
+                              memory_order_relaxed);
+        ops->unlock();
+        count++;
+        writes++;
+
+        for (int i = 0; i < OUTSIDE_WORK; i++) {
+            local = local * 31 + i;
+        }
+    }
+    atomic_fetch_add(&total_ops, count);
+    atomic_fetch_add(&total_writes, writes);
+    return NULL;
+}
+
+/* Returns throughput in millions of critical sections per second */
+static double
+run(int threads, int milliseconds)
+{
+    pthread_t handles[MAX_THREADS];
+    uint64_t start;
+    double seconds;
+
+    ops->init();
+    atomic_init(&shared.counter, 0);
+    atomic_init(&shared.shadow, 0);
+    atomic_init(&total_ops, 0);
+    atomic_init(&total_writes, 0);
+    running = true;
+
+    start = get_time_ns();
+    for (int i=0; i<threads; ++i) {
+        pthread_create(&handles[i], NULL, worker, (void*)(uintptr_t)i);
+    }
+    usleep(milliseconds * 1000);
+    running = false;
+    for (int i=0; i<threads; ++i) {
+        pthread_join(handles[i], NULL);
+    }
+    seconds = (get_time_ns() - start) / 1e9;
+
+    if (atomic_load(&shared.counter) != atomic_load(&total_writes) ||
+        !shared_consistent()) {
+        error = true;
+    }
+    ops->destroy();
+    return atomic_load(&total_ops) / seconds / 1e6;
+}
+
+#ifdef SPINLOCK_STATS
+static void
+print_spinlock_stats(void)
+{
+    struct spinlock_stats stats;
+    spinlock_get_stats(&spin, &stats);
+    printf("  spinlock: %lu acquisitions, %.2lf%% contended, "
+           "%.2lf backoff rounds per contended acquisition\n",
+           stats.acquisitions,
+           stats.acquisitions ? 100.0 * stats.contended / stats.acquisitions
+                              : 0,
+           stats.contended ? (double)stats.spins / stats.contended : 0);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    /* Parse arguments */
+    for (int i=0; i<argc; i++) {
+        if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i])) {
+            printf("Tests throughput and correctness of locks under "
+                   "contention.\n"
+                   "Usage: %s [MILLISECONDS] [THREADS]\n"
+                   "Runs every power-of-2 number of threads up to THREADS. "
+                   "With reader-writer locks, 1 in %d critical sections "
+                   "writes.\n"
+                   "Defaults: %d milliseconds per run, %d threads.\n",
+                   argv[0], WRITE_EVERY, DEFAULT_MILLISECONDS,
+                   DEFAULT_THREADS);
+            exit(1);
+        }
+    }
+    int milliseconds = argc >=2 ? atoi(argv[1]) : DEFAULT_MILLISECONDS;
+    int threads = argc >=3 ? atoi(argv[2]) : DEFAULT_THREADS;
+    threads = MIN(MAX(threads, 1), MAX_THREADS);
+    int num_locks = sizeof(locks) / sizeof(*locks);
+
+    printf("%-10s", "threads");
+    for (int l=0; l<num_locks; l++) {
+        printf(" %-12s", locks[l].name);
+    }
+    printf("   (Mops/s)\n");
+
+    for (int t=1; t<=threads; t*=2) {
+        printf("%-10d", t);
+        for (int l=0; l<num_locks; l++) {
+            ops = &locks[l];
+            printf(" %-12.2lf", run(t, milliseconds));
+            fflush(stdout);
+        }
+        printf("\n");
+#ifdef SPINLOCK_STATS
+        print_spinlock_stats();
+#endif
+    }
+
+#ifdef LOCK_PROFILE
+    lock_profile_report(stdout, 10);
+#endif
+
+    /* Check for correctness errors */
+    if (error) {
+        printf("Error: correctness issue\n");
+    }
+
+    return error;
+}
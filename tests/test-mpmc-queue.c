@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include "lib/util.h"
+#include "lib/mpmc-queue.h"
+#include "lib/perf.h"
+
+#define DEFAULT_MILLISECONDS 250
+#define DEFAULT_THREADS 4
+#define QUEUE_SIZE 4096
+#define BATCH_SIZE 32
+#define MAX_PRODUCERS 64
+#define PRODUCER_SHIFT 40
+
+static struct mpmc_queue queue;
+static volatile bool running;
+static volatile bool error;
+static int num_producers;
+static int batch_size;
+
+static atomic_ulong produced_sum;
+static atomic_ulong consumed_sum;
+static atomic_ulong consumed_count;
+static atomic_int producers_done;
+
+/* Values encode the producer id and a per-producer sequence number, which
+ * must be observed in increasing order by every consumer. */
+static void*
+producer(void *args)
+{
+    uint64_t id = (uintptr_t)args;
+    uint64_t seq = 1;
+    uint64_t sum = 0;
+    void *data[BATCH_SIZE];
+    size_t n;
+
+    while (running) {
+        for (int i = 0; i < batch_size; i++) {
+            data[i] = (void*)(uintptr_t)(id << PRODUCER_SHIFT | (seq + i));
+        }
+        n = mpmc_queue_enqueue_batch(&queue, data, batch_size);
+        for (size_t i = 0; i < n; i++) {
+            sum += (uintptr_t)data[i];
+        }
+        seq += n;
+    }
+    atomic_fetch_add(&produced_sum, sum);
+    atomic_fetch_add(&producers_done, 1);
+    return NULL;
+}
+
+static void*
+consumer(void *args)
+{
+    uint64_t last[MAX_PRODUCERS];
+    uint64_t sum = 0;
+    uint64_t count = 0;
+    void *data[BATCH_SIZE];
+    uint64_t value, id;
+    size_t n;
+
+    memset(last, 0, sizeof(last));
+    while (1) {
+        n = mpmc_queue_dequeue_batch(&queue, data, batch_size);
+        if (!n) {
+            /* Drain the queue after all producers are done */
+            if (atomic_load(&producers_done) == num_producers &&
+                !mpmc_queue_size(&queue)) {
+                break;
+            }
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            value = (uintptr_t)data[i];
+            id = value >> PRODUCER_SHIFT;
+            if (last[id] >= (value & ((1ULL << PRODUCER_SHIFT) - 1))) {
+                error = true;
+            }
+            last[id] = value & ((1ULL << PRODUCER_SHIFT) - 1);
+            sum += value;
+        }
+        count += n;
+    }
+    atomic_fetch_add(&consumed_sum, sum);
+    atomic_fetch_add(&consumed_count, count);
+    return NULL;
+}
+
+/* Returns throughput in millions of elements per second */
+static double
+run(int producers, int consumers, int batch, int milliseconds)
+{
+    pthread_t *threads;
+    uint64_t start;
+    double seconds;
+
+    mpmc_queue_init(&queue, QUEUE_SIZE);
+    atomic_init(&produced_sum, 0);
+    atomic_init(&consumed_sum, 0);
+    atomic_init(&consumed_count, 0);
+    atomic_init(&producers_done, 0);
+    num_producers = producers;
+    batch_size = batch;
+    running = true;
+
+    threads = (pthread_t*)xmalloc(sizeof(*threads)*(producers+consumers));
+    start = get_time_ns();
+    for (int i=0; i<consumers; ++i) {
+        pthread_create(&threads[i], NULL, consumer, NULL);
+    }
+    for (int i=0; i<producers; ++i) {
+        pthread_create(&threads[consumers+i], NULL, producer,
+                       (void*)(uintptr_t)i);
+    }
+    usleep(milliseconds * 1000);
+    running = false;
+    for (int i=0; i<producers+consumers; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    seconds = (get_time_ns() - start) / 1e9;
+
+    if (atomic_load(&produced_sum) != atomic_load(&consumed_sum)) {
+        error = true;
+    }
+
+    free(threads);
+    mpmc_queue_destroy(&queue);
+    return atomic_load(&consumed_count) / seconds / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse arguments */
+    for (int i=0; i<argc; i++) {
+        if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i])) {
+            printf("Tests throughput and correctness of mpmc_queue.\n"
+                   "Usage: %s [MILLISECONDS] [THREADS]\n"
+                   "Runs every power-of-2 combination of producers and "
+                   "consumers up to THREADS.\n"
+                   "Defaults: %d milliseconds per run, %d threads.\n",
+                   argv[0], DEFAULT_MILLISECONDS, DEFAULT_THREADS);
+            exit(1);
+        }
+    }
+    int milliseconds = argc >=2 ? atoi(argv[1]) : DEFAULT_MILLISECONDS;
+    int threads = argc >=3 ? atoi(argv[2]) : DEFAULT_THREADS;
+    threads = MIN(MAX(threads, 1), MAX_PRODUCERS);
+
+    printf("%-10s %-10s %-16s %-16s\n",
+           "producers", "consumers", "Mops/s (single)", "Mops/s (batch)");
+    for (int p=1; p<=threads; p*=2) {
+        for (int c=1; c<=threads; c*=2) {
+            double single = run(p, c, 1, milliseconds);
+            double batch = run(p, c, BATCH_SIZE, milliseconds);
+            printf("%-10d %-10d %-16.2lf %-16.2lf\n", p, c, single, batch);
+        }
+    }
+
+    /* Check for correctness errors */
+    if (error) {
+        printf("Error: correctness issue\n");
+    }
+
+    return error;
+}
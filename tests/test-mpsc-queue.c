@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "lib/util.h"
+#include "lib/mpsc-queue.h"
+#include "lib/perf.h"
+
+#define DEFAULT_NODES 100000
+#define DEFAULT_THREADS 4
+#define MAX_PRODUCERS 64
+#define POP_BURST 16
+
+struct element {
+    struct mpsc_queue_node node;
+    int producer;
+    uint64_t seq;
+    bool seen;
+};
+
+static struct mpsc_queue queue;
+static volatile bool error;
+static struct element *elements;
+static int num_nodes;
+
+static void*
+producer(void *args)
+{
+    int id = (uintptr_t)args;
+    struct element *e = &elements[(size_t)id * num_nodes];
+
+    for (int i = 0; i < num_nodes; i++) {
+        e[i].producer = id;
+        e[i].seq = i + 1;
+        e[i].seen = false;
+        mpsc_queue_push(&queue, &e[i].node);
+        /* Lets the consumer in, also with fewer CPUs than threads */
+        if (!(i % 256)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/* Each node must arrive once, and in push order among the nodes of its
+ * producer */
+static void
+consume(struct element *e, uint64_t *last)
+{
+    if (e->seen || e->seq != last[e->producer] + 1) {
+        error = true;
+    }
+    e->seen = true;
+    last[e->producer] = e->seq;
+}
+
+/* Returns throughput in millions of elements per second */
+static double
+run(int producers, int pop_all_every)
+{
+    pthread_t threads[MAX_PRODUCERS];
+    uint64_t last[MAX_PRODUCERS];
+    uint64_t total = (uint64_t)producers * num_nodes;
+    uint64_t count = 0;
+    uint64_t prev = 0;
+    struct mpsc_queue_batch batch;
+    struct mpsc_queue_node *node;
+    struct element *e;
+    uint64_t start;
+    double seconds;
+
+    elements = xmalloc(sizeof(*elements) * total);
+    memset(last, 0, sizeof(last));
+    mpsc_queue_init(&queue);
+
+    start = get_time_ns();
+    for (int i = 0; i < producers; i++) {
+        pthread_create(&threads[i], NULL, producer, (void*)(uintptr_t)i);
+    }
+
+    /* Interleaves bursts of "mpsc_queue_pop" with "mpsc_queue_pop_all",
+     * which switches stubs while producers push */
+    for (int round = 1; count < total; round++) {
+        if (count == prev) {
+            sched_yield();
+        }
+        prev = count;
+        if (pop_all_every && !(round % pop_all_every)) {
+            batch = mpsc_queue_pop_all(&queue);
+            MPSC_QUEUE_BATCH_FOR_EACH (e, node, &batch) {
+                consume(e, last);
+                count++;
+            }
+            continue;
+        }
+        for (int i = 0; i < POP_BURST; i++) {
+            node = mpsc_queue_pop(&queue);
+            if (!node) {
+                break;
+            }
+            consume(CONTAINER_OF(node, struct element, node), last);
+            count++;
+        }
+    }
+
+    for (int i = 0; i < producers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    seconds = (get_time_ns() - start) / 1e9;
+
+    /* Nothing left, and nothing more than pushed */
+    batch = mpsc_queue_pop_all(&queue);
+    if (mpsc_queue_pop(&queue) || mpsc_queue_batch_pop(&batch) ||
+        count != total) {
+        error = true;
+    }
+    for (int i = 0; i < producers; i++) {
+        if (last[i] != (uint64_t)num_nodes) {
+            error = true;
+        }
+    }
+
+    free(elements);
+    return total / seconds / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse arguments */
+    for (int i=0; i<argc; i++) {
+        if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i])) {
+            printf("Tests throughput and correctness of mpsc_queue.\n"
+                   "Usage: %s [NODES] [THREADS]\n"
+                   "Every power-of-2 number of producers up to THREADS "
+                   "pushes NODES nodes each to one consumer.\n"
+                   "Defaults: %d nodes, %d threads.\n",
+                   argv[0], DEFAULT_NODES, DEFAULT_THREADS);
+            exit(1);
+        }
+    }
+    num_nodes = argc >=2 ? atoi(argv[1]) : DEFAULT_NODES;
+    int threads = argc >=3 ? atoi(argv[2]) : DEFAULT_THREADS;
+    threads = MIN(MAX(threads, 1), MAX_PRODUCERS);
+    num_nodes = MAX(num_nodes, 1);
+
+    printf("%-10s %-16s %-16s %-16s\n", "producers",
+           "Mops/s (pop)", "Mops/s (pop_all)", "Mops/s (mixed)");
+    for (int p=1; p<=threads; p*=2) {
+        double pop = run(p, 0);
+        double pop_all = run(p, 1);
+        double mixed = run(p, 3);
+        printf("%-10d %-16.2lf %-16.2lf %-16.2lf\n",
+               p, pop, pop_all, mixed);
+    }
+
+    /* Check for correctness errors */
+    if (error) {
+        printf("Error: correctness issue\n");
+    }
+
+    return error;
+}
@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "lib/util.h"
+#include "lib/refcnt.h"
+#include "lib/perf.h"
+
+#define DEFAULT_ROUNDS 200
+#define DEFAULT_THREADS 3
+#define MAX_THREADS 64
+#define OWNER_REFS 4        /* Taken by the owner on top of the initial one */
+#define HELD_REFS 3         /* Held by each other thread until released */
+#define CHURN 100           /* Reference and drop pairs of other threads */
+
+/* Order in which the owner drops its references */
+enum order {
+    OWNER_FIRST,            /* Before the other threads drop theirs */
+    OWNER_LAST,             /* After all of them */
+    OWNER_CONCURRENT,       /* While they drop theirs */
+    ORDERS
+};
+
+static const char *order_names[] = { "owner first", "owner last",
+                                     "concurrent" };
+
+static struct brefcnt refcnt;
+static atomic_int ready;
+static atomic_bool go;
+static atomic_int last_drops;   /* "brefcnt_unref" calls that returned true */
+static volatile bool error;
+
+static void
+wait_for(atomic_bool *flag)
+{
+    while (!atomic_load(flag)) {
+        sched_yield();
+    }
+}
+
+/* Not the owner: takes references, some of which it drops at once while
+ * others keep the count above zero, then drops the rest once released */
+static void*
+other(void *args)
+{
+    (void)args;
+
+    for (int i = 0; i < HELD_REFS; i++) {
+        brefcnt_ref(&refcnt);
+    }
+    for (int i = 0; i < CHURN; i++) {
+        brefcnt_ref(&refcnt);
+        if (brefcnt_unref(&refcnt)) {
+            error = true;
+        }
+    }
+    atomic_fetch_add(&ready, 1);
+
+    wait_for(&go);
+    for (int i = 0; i < HELD_REFS; i++) {
+        if (brefcnt_unref(&refcnt)) {
+            atomic_fetch_add(&last_drops, 1);
+        }
+    }
+    return NULL;
+}
+
+/* The calling thread owns "refcnt" */
+static void
+owner_drop(void)
+{
+    for (int i = 0; i <= OWNER_REFS; i++) {
+        if (brefcnt_unref(&refcnt)) {
+            atomic_fetch_add(&last_drops, 1);
+        }
+    }
+}
+
+static void
+run(int threads, enum order order)
+{
+    pthread_t workers[MAX_THREADS];
+
+    brefcnt_init(&refcnt);
+    for (int i = 0; i < OWNER_REFS; i++) {
+        brefcnt_ref(&refcnt);
+    }
+    atomic_store(&ready, 0);
+    atomic_store(&go, false);
+    atomic_store(&last_drops, 0);
+
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, other, NULL);
+    }
+    while (atomic_load(&ready) != threads) {
+        sched_yield();
+    }
+
+    switch (order) {
+    case OWNER_FIRST:
+        owner_drop();
+        /* No longer the owner, so takes a shared reference */
+        brefcnt_ref(&refcnt);
+        if (brefcnt_unref(&refcnt) || atomic_load(&last_drops)) {
+            error = true;
+        }
+        atomic_store(&go, true);
+        break;
+    case OWNER_LAST:
+        atomic_store(&go, true);
+        for (int i = 0; i < threads; i++) {
+            pthread_join(workers[i], NULL);
+        }
+        if (atomic_load(&last_drops)) {
+            error = true;
+        }
+        owner_drop();
+        threads = 0;
+        break;
+    default:
+        atomic_store(&go, true);
+        owner_drop();
+        break;
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    /* Exactly one drop was the last, and the owner's count was merged, as
+     * "brefcnt_destroy" asserts */
+    if (atomic_load(&last_drops) != 1 ||
+        atomic_load(&refcnt.shared) != BREFCNT_MERGED ||
+        atomic_load(&refcnt.owner) != 0) {
+        error = true;
+    }
+    brefcnt_destroy(&refcnt);
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse arguments */
+    for (int i=0; i<argc; i++) {
+        if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i])) {
+            printf("Tests correctness of brefcnt.\n"
+                   "Usage: %s [ROUNDS] [THREADS]\n"
+                   "In each round, the owner and THREADS other threads "
+                   "take and drop references; the owner drops its own "
+                   "before, after, or along with the others.\n"
+                   "Defaults: %d rounds, %d threads.\n",
+                   argv[0], DEFAULT_ROUNDS, DEFAULT_THREADS);
+            exit(1);
+        }
+    }
+    int rounds = argc >=2 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    int threads = argc >=3 ? atoi(argv[2]) : DEFAULT_THREADS;
+    threads = MIN(MAX(threads, 1), MAX_THREADS);
+
+    /* Only the owner */
+    brefcnt_init(&refcnt);
+    brefcnt_ref(&refcnt);
+    if (brefcnt_unref(&refcnt) || !brefcnt_unref(&refcnt) ||
+        atomic_load(&refcnt.shared) != BREFCNT_MERGED) {
+        error = true;
+    }
+    brefcnt_destroy(&refcnt);
+
+    printf("%-16s %-10s %-10s\n", "order", "threads", "ms");
+    for (int o=0; o<ORDERS; o++) {
+        for (int t=1; t<=threads; t++) {
+            uint64_t start = get_time_ns();
+            for (int r=0; r<rounds; r++) {
+                run(t, o);
+            }
+            printf("%-16s %-10d %-10.2lf\n", order_names[o], t,
+                   (get_time_ns() - start) / 1e6);
+        }
+    }
+
+    /* Check for correctness errors */
+    if (error) {
+        printf("Error: correctness issue\n");
+    }
+
+    return error;
+}
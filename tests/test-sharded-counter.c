@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "lib/util.h"
+#include "lib/sharded-counter.h"
+#include "lib/random.h"
+#include "lib/perf.h"
+
+#define DEFAULT_OPERATIONS 1000000
+#define DEFAULT_THREADS 4
+#define MAX_THREADS 64
+
+static struct sharded_counter counter;
+static atomic_long plain;
+static volatile bool error;
+static int num_operations;
+
+struct worker {
+    pthread_t thread;
+    uint32_t seed;
+    bool use_plain;
+    long expected;          /* Sum of what this thread added */
+};
+
+static void*
+worker(void *args)
+{
+    struct worker *w = args;
+    uint32_t x = w->seed;
+    long expected = 0;
+    long delta;
+
+    for (int i = 0; i < num_operations; i++) {
+        /* xorshift, so the threads do not share the state of "random" */
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        switch (x % 4) {
+        case 0:
+            delta = (long)(x >> 8) - (1 << 23);
+            break;
+        case 1:
+            delta = 1;
+            break;
+        default:
+            delta = -1;
+            break;
+        }
+        if (w->use_plain) {
+            atomic_fetch_add_explicit(&plain, delta, memory_order_relaxed);
+        } else if (delta == 1) {
+            sharded_counter_inc(&counter);
+        } else if (delta == -1) {
+            sharded_counter_dec(&counter);
+        } else {
+            sharded_counter_add(&counter, delta);
+        }
+        expected += delta;
+    }
+    w->expected = expected;
+    return NULL;
+}
+
+/* Runs "threads" threads on a counter of "shards" shards, or on a plain
+ * atomic if "use_plain". The sum must be exact once they have joined.
+ * Returns throughput in millions of operations per second. */
+static double
+run(int threads, unsigned int shards, bool use_plain)
+{
+    struct worker workers[MAX_THREADS];
+    long expected = 0;
+    uint64_t start;
+    double seconds;
+    long value;
+
+    sharded_counter_init(&counter, shards);
+    atomic_store(&plain, 0);
+
+    start = get_time_ns();
+    for (int i = 0; i < threads; i++) {
+        workers[i].seed = random_uint32() | 1;
+        workers[i].use_plain = use_plain;
+        pthread_create(&workers[i].thread, NULL, worker, &workers[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        expected += workers[i].expected;
+    }
+    seconds = (get_time_ns() - start) / 1e9;
+
+    value = use_plain ? atomic_load(&plain) : sharded_counter_read(&counter);
+    if (value != expected) {
+        printf("Error: counter is %ld, expected %ld\n", value, expected);
+        error = true;
+    }
+    sharded_counter_reset(&counter);
+    if (sharded_counter_read(&counter)) {
+        error = true;
+    }
+    sharded_counter_destroy(&counter);
+
+    return (double)threads * num_operations / seconds / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse arguments */
+    for (int i=0; i<argc; i++) {
+        if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i])) {
+            printf("Tests throughput and correctness of sharded_counter.\n"
+                   "Usage: %s [OPERATIONS] [THREADS]\n"
+                   "Every power-of-2 number of threads up to THREADS adds, "
+                   "increments and decrements OPERATIONS times each, on "
+                   "sharded counters and on a plain atomic.\n"
+                   "Defaults: %d operations, %d threads.\n",
+                   argv[0], DEFAULT_OPERATIONS, DEFAULT_THREADS);
+            exit(1);
+        }
+    }
+    num_operations = argc >=2 ? atoi(argv[1]) : DEFAULT_OPERATIONS;
+    int threads = argc >=3 ? atoi(argv[2]) : DEFAULT_THREADS;
+    threads = MIN(MAX(threads, 1), MAX_THREADS);
+    num_operations = MAX(num_operations, 1);
+
+    printf("%-10s %-16s %-16s %-16s\n", "threads", "Mops/s (1 shard)",
+           "Mops/s (per CPU)", "Mops/s (atomic)");
+    for (int t=1; t<=threads; t*=2) {
+        double one = run(t, 1, false);
+        double per_cpu = run(t, 0, false);
+        double atomic = run(t, 0, true);
+        printf("%-10d %-16.2lf %-16.2lf %-16.2lf\n",
+               t, one, per_cpu, atomic);
+    }
+
+    /* Rounded up to a power of 2 */
+    run(threads, 3, false);
+
+    /* Check for correctness errors */
+    if (error) {
+        printf("Error: correctness issue\n");
+    }
+
+    return error;
+}
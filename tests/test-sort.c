@@ -0,0 +1,333 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <float.h>
+
+#include "lib/util.h"
+#include "lib/random.h"
+#include "lib/sort.h"
+#include "lib/vector.h"
+#include "lib/perf.h"
+
+#define DEFAULT_SEED 1
+#define MAX_VALUE_SIZE 16
+
+/* Key distributions */
+enum {
+    KEYS_RANDOM,        /* Including negative and special floats */
+    KEYS_FEW,           /* Many duplicates, to check stability */
+    KEYS_SORTED,
+    KEYS_REVERSED,
+    KEYS_NUM
+};
+
+static const char *key_names[] = { "uint32", "uint64", "float" };
+static const char *dist_names[] = { "random", "few" };
+
+static bool error;
+
+/* A key of any "sort_key_type" along with its original index */
+struct ref {
+    union {
+        uint32_t u32;
+        uint64_t u64;
+        float f;
+    } key;
+    uint32_t index;
+};
+
+static enum sort_key_type ref_type;
+
+/* Ascending by key, then by index, which is what a stable sort yields.
+ * Orders -0.0 before +0.0. */
+static int
+compare_refs(const void *a_, const void *b_)
+{
+    const struct ref *a = a_;
+    const struct ref *b = b_;
+
+    switch (ref_type) {
+    case SORT_KEY_UINT32:
+        if (a->key.u32 != b->key.u32) {
+            return a->key.u32 < b->key.u32 ? -1 : 1;
+        }
+        break;
+    case SORT_KEY_UINT64:
+        if (a->key.u64 != b->key.u64) {
+            return a->key.u64 < b->key.u64 ? -1 : 1;
+        }
+        break;
+    case SORT_KEY_FLOAT:
+        if (a->key.f != b->key.f) {
+            return a->key.f < b->key.f ? -1 : 1;
+        }
+        if (signbit(a->key.f) != signbit(b->key.f)) {
+            return signbit(a->key.f) ? -1 : 1;
+        }
+        break;
+    }
+    return a->index < b->index ? -1 : a->index > b->index;
+}
+
+static float
+random_float(void)
+{
+    static const float specials[] = {
+        0.0f, -0.0f, INFINITY, -INFINITY, 1e-40f, -1e-40f, FLT_MAX, -FLT_MAX
+    };
+
+    if (!random_range(64)) {
+        return specials[random_range(sizeof(specials) / sizeof(*specials))];
+    }
+    return (random_double() - 0.5) * 2e6;
+}
+
+/* Sets the key of "ref" number "i" of "n" */
+static void
+make_key(struct ref *ref, size_t i, size_t n, int dist)
+{
+    uint64_t x;
+
+    ref->index = i;
+    switch (dist) {
+    case KEYS_RANDOM:
+        if (ref_type == SORT_KEY_FLOAT) {
+            ref->key.f = random_float();
+        } else {
+            ref->key.u64 = random_uint64();
+        }
+        return;
+    case KEYS_FEW:
+        x = random_range(16);
+        break;
+    case KEYS_SORTED:
+        x = i;
+        break;
+    default:
+        x = n - i;
+        break;
+    }
+    /* Negative floats half of the time */
+    if (ref_type == SORT_KEY_FLOAT) {
+        ref->key.f = (float)x - (dist == KEYS_FEW ? 8 : n / 2);
+    } else if (ref_type == SORT_KEY_UINT64) {
+        ref->key.u64 = x << 32 | x;
+    } else {
+        ref->key.u64 = x;
+    }
+}
+
+/* Payload of the element with original index "index" */
+static void
+make_value(char *value, size_t value_size, uint32_t index)
+{
+    memcpy(value, &index, MIN(value_size, sizeof(index)));
+    for (size_t i = sizeof(index); i < value_size; i++) {
+        value[i] = index * 7 + i;
+    }
+}
+
+/* Sorts "n" keys of "ref_type" with payloads of "value_size" bytes (or
+ * none if 0) using "threads" threads, or the single-threaded API if
+ * negative. Compares the result with qsort. Returns the time the radix
+ * sort took in milliseconds. */
+static double
+run(size_t n, int dist, size_t value_size, int threads)
+{
+    size_t key_size = ref_type == SORT_KEY_UINT64 ? 8 : 4;
+    char expected[MAX_VALUE_SIZE];
+    struct ref *refs;
+    char *values;
+    char *keys;
+    uint64_t start;
+    double ms;
+
+    refs = xmalloc(sizeof(*refs) * MAX(n, 1));
+    keys = xmalloc(key_size * MAX(n, 1));
+    values = value_size ? xmalloc(value_size * MAX(n, 1)) : NULL;
+    for (size_t i = 0; i < n; i++) {
+        make_key(&refs[i], i, n, dist);
+        memcpy(&keys[i * key_size], &refs[i].key, key_size);
+        if (values) {
+            make_value(&values[i * value_size], value_size, i);
+        }
+    }
+
+    start = get_time_ns();
+    switch (ref_type) {
+    case SORT_KEY_UINT32:
+        if (threads < 0) {
+            sort_uint32((uint32_t*)keys, values, value_size, n);
+        } else {
+            sort_uint32_parallel((uint32_t*)keys, values, value_size, n,
+                                 threads);
+        }
+        break;
+    case SORT_KEY_UINT64:
+        if (threads < 0) {
+            sort_uint64((uint64_t*)keys, values, value_size, n);
+        } else {
+            sort_uint64_parallel((uint64_t*)keys, values, value_size, n,
+                                 threads);
+        }
+        break;
+    case SORT_KEY_FLOAT:
+        if (threads < 0) {
+            sort_float((float*)keys, values, value_size, n);
+        } else {
+            sort_float_parallel((float*)keys, values, value_size, n,
+                                threads);
+        }
+        break;
+    }
+    ms = (get_time_ns() - start) / 1e6;
+
+    /* Same keys, bit for bit, and payloads in the same stable order */
+    qsort(refs, n, sizeof(*refs), compare_refs);
+    for (size_t i = 0; i < n; i++) {
+        if (memcmp(&keys[i * key_size], &refs[i].key, key_size)) {
+            error = true;
+        }
+        if (values) {
+            make_value(expected, value_size, refs[i].index);
+            if (memcmp(&values[i * value_size], expected, value_size)) {
+                error = true;
+            }
+        }
+    }
+
+    free(refs);
+    free(keys);
+    free(values);
+    return ms;
+}
+
+/* Elements of the vector under "vector_sort" */
+struct record {
+    uint32_t index;
+    float f;
+    uint64_t u64;
+    uint32_t u32;
+};
+
+/* Sorts a vector of "n" records by each key type and compares with qsort.
+ * The permutation is applied in place by following its cycles, so sorted,
+ * reversed (cycles of two) and rotated (a single cycle) inputs are tried
+ * along with random ones. */
+static void
+run_vector(size_t n)
+{
+    static const size_t offsets[] = {
+        offsetof(struct record, u32),
+        offsetof(struct record, u64),
+        offsetof(struct record, f),
+    };
+    struct vector *vector;
+    struct record record;
+    struct ref *refs;
+    size_t i;
+
+    refs = xmalloc(sizeof(*refs) * MAX(n, 1));
+    for (int type = 0; type < 3; type++) {
+        ref_type = type;
+        for (int dist = 0; dist <= KEYS_NUM; dist++) {
+            vector = vector_init(sizeof(struct record));
+            for (i = 0; i < n; i++) {
+                /* KEYS_NUM stands for sorted keys rotated by one */
+                if (dist == KEYS_NUM) {
+                    make_key(&refs[i], (i + 1) % n, n, KEYS_SORTED);
+                    refs[i].index = i;
+                } else {
+                    make_key(&refs[i], i, n, dist);
+                }
+                memset(&record, 0, sizeof(record));
+                record.index = i;
+                memcpy((char*)&record + offsets[type], &refs[i].key,
+                       type == SORT_KEY_UINT64 ? 8 : 4);
+                vector_push(vector, &record);
+            }
+
+            vector_sort(vector, offsets[type], type);
+            qsort(refs, n, sizeof(*refs), compare_refs);
+
+            i = 0;
+            VECTOR_FOR_EACH(vector, record, struct record) {
+                if (i >= n || record.index != refs[i].index ||
+                    memcmp((char*)&record + offsets[type], &refs[i].key,
+                           type == SORT_KEY_UINT64 ? 8 : 4)) {
+                    error = true;
+                }
+                i++;
+            }
+            if (i != n) {
+                error = true;
+            }
+            vector_destroy(vector);
+        }
+    }
+    free(refs);
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse arguments */
+    for (int i=0; i<argc; i++) {
+        if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i])) {
+            printf("Tests correctness of radix sort and vector_sort "
+                   "against qsort.\n"
+                   "Usage: %s [SEED]\n"
+                   "Sorts every key type with payloads of several sizes, "
+                   "then above SORT_PARALLEL_THRESHOLD keys with 2 and 4 "
+                   "threads.\n"
+                   "Defaults: seed %d.\n",
+                   argv[0], DEFAULT_SEED);
+            exit(1);
+        }
+    }
+    int seed = argc >=2 ? atoi(argv[1]) : DEFAULT_SEED;
+    random_set_seed(seed);
+
+    static const size_t sizes[] = { 0, 1, 2, 3, 17, 1000, 65537 };
+    static const size_t value_sizes[] = { 0, 4, 12, 16 };
+
+    for (size_t s=0; s<sizeof(sizes)/sizeof(*sizes); s++) {
+        for (int type=0; type<3; type++) {
+            ref_type = type;
+            for (int dist=0; dist<KEYS_NUM; dist++) {
+                for (size_t v=0; v<sizeof(value_sizes)/sizeof(*value_sizes);
+                     v++) {
+                    run(sizes[s], dist, value_sizes[v], -1);
+                }
+                /* Below the threshold, on the calling thread */
+                run(sizes[s], dist, 4, 4);
+            }
+        }
+    }
+
+    size_t n = SORT_PARALLEL_THRESHOLD + 12345;
+    printf("%-10s %-10s %-10s %-10s\n", "keys", "order", "threads", "ms");
+    for (int type=0; type<3; type++) {
+        ref_type = type;
+        for (int dist=0; dist<KEYS_FEW+1; dist++) {
+            for (int t=2; t<=4; t*=2) {
+                double ms = run(n, dist, 12, t);
+                printf("%-10s %-10s %-10d %-10.2lf\n",
+                       key_names[type], dist_names[dist], t, ms);
+            }
+        }
+    }
+
+    run_vector(0);
+    run_vector(1);
+    run_vector(10000);
+
+    /* Check for correctness errors */
+    if (error) {
+        printf("Error: correctness issue\n");
+    }
+
+    return error;
+}
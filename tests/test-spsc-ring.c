@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "lib/util.h"
+#include "lib/spsc-ring.h"
+#include "lib/perf.h"
+
+#define DEFAULT_MILLISECONDS 250
+#define RING_SIZE 1024
+#define BATCH_SIZE 32
+#define SHUTDOWN_ROUNDS 1000
+
+static struct spsc_ring ring;
+static volatile bool running;
+static atomic_bool stop;
+static volatile bool error;
+static bool blocking;
+static int batch_size;
+
+/* Values are a sequence number, which the consumer must observe without
+ * gaps and in order, and end with NULL, after which nothing may follow */
+static void*
+producer(void *args)
+{
+    uint64_t seq = 1;
+    void *data[BATCH_SIZE];
+    size_t n;
+
+    (void)args;
+    while (running) {
+        for (int i = 0; i < batch_size; i++) {
+            data[i] = (void*)(uintptr_t)(seq + i);
+        }
+        n = batch_size == 1 ? spsc_ring_enqueue(&ring, data[0])
+                            : spsc_ring_enqueue_n(&ring, data, batch_size);
+        seq += n;
+    }
+    while (!spsc_ring_enqueue(&ring, NULL)) {
+        cpu_relax();
+    }
+    return (void*)(uintptr_t)(seq - 1);
+}
+
+static void*
+consumer(void *args)
+{
+    uint64_t last = 0;
+    void *data[BATCH_SIZE];
+    size_t n;
+
+    (void)args;
+    while (1) {
+        if (blocking) {
+            n = spsc_ring_dequeue_wait(&ring, data, batch_size);
+        } else if (batch_size == 1) {
+            n = spsc_ring_dequeue(&ring, data);
+        } else {
+            n = spsc_ring_dequeue_n(&ring, data, batch_size);
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (!data[i]) {
+                /* Nothing may follow the end */
+                if (i != n - 1 || spsc_ring_size(&ring)) {
+                    error = true;
+                }
+                return (void*)(uintptr_t)last;
+            }
+            if ((uintptr_t)data[i] != last + 1) {
+                error = true;
+            }
+            last = (uintptr_t)data[i];
+        }
+    }
+}
+
+/* Waits on an empty ring until "stop" */
+static void*
+stopped_consumer(void *args)
+{
+    void *data[BATCH_SIZE];
+
+    (void)args;
+    while (!atomic_load(&stop)) {
+        /* Lets the notification arrive before the wait starts */
+        sched_yield();
+        if (spsc_ring_dequeue_wait(&ring, data, BATCH_SIZE)) {
+            error = true;
+        }
+    }
+    return NULL;
+}
+
+/* Shuts a parking consumer down with a flag and "spsc_ring_notify", sent
+ * at varying points: before it waits, while it spins, or once it parked.
+ * A notification that is lost hangs the test. */
+static void
+test_shutdown(void)
+{
+    pthread_t thread;
+
+    spsc_ring_init(&ring, RING_SIZE, true);
+    for (int i = 0; i < SHUTDOWN_ROUNDS; i++) {
+        atomic_store(&stop, false);
+        pthread_create(&thread, NULL, stopped_consumer, NULL);
+        for (int j = 0; j < i % 8; j++) {
+            sched_yield();
+        }
+        atomic_store(&stop, true);
+        spsc_ring_notify(&ring);
+        pthread_join(thread, NULL);
+    }
+    spsc_ring_destroy(&ring);
+}
+
+/* Returns throughput in millions of elements per second */
+static double
+run(bool blocking_, int batch, int milliseconds)
+{
+    pthread_t threads[2];
+    void *produced, *consumed;
+    uint64_t start;
+    double seconds;
+
+    spsc_ring_init(&ring, RING_SIZE, blocking_);
+    blocking = blocking_;
+    batch_size = batch;
+    running = true;
+
+    start = get_time_ns();
+    pthread_create(&threads[0], NULL, consumer, NULL);
+    pthread_create(&threads[1], NULL, producer, NULL);
+    usleep(milliseconds * 1000);
+    running = false;
+    pthread_join(threads[1], &produced);
+    pthread_join(threads[0], &consumed);
+    seconds = (get_time_ns() - start) / 1e9;
+
+    /* Every element arrived */
+    if (produced != consumed || spsc_ring_size(&ring)) {
+        error = true;
+    }
+
+    spsc_ring_destroy(&ring);
+    return (uintptr_t)consumed / seconds / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse arguments */
+    for (int i=0; i<argc; i++) {
+        if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i])) {
+            printf("Tests throughput and correctness of spsc_ring.\n"
+                   "Usage: %s [MILLISECONDS]\n"
+                   "Runs a producer and a consumer with a non-blocking and "
+                   "a blocking ring, then shuts down parked consumers.\n"
+                   "Defaults: %d milliseconds per run.\n",
+                   argv[0], DEFAULT_MILLISECONDS);
+            exit(1);
+        }
+    }
+    int milliseconds = argc >=2 ? atoi(argv[1]) : DEFAULT_MILLISECONDS;
+
+    printf("%-10s %-16s %-16s\n",
+           "mode", "Mops/s (single)", "Mops/s (batch)");
+    for (int b=0; b<2; b++) {
+        double single = run(b, 1, milliseconds);
+        double batch = run(b, BATCH_SIZE, milliseconds);
+        printf("%-10s %-16.2lf %-16.2lf\n",
+               b ? "blocking" : "spinning", single, batch);
+    }
+
+    test_shutdown();
+
+    /* Check for correctness errors */
+    if (error) {
+        printf("Error: correctness issue\n");
+    }
+
+    return error;
+}
@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "lib/util.h"
+#include "lib/thread-sync.h"
+#include "lib/perf.h"
+
+#define DEFAULT_BARRIERS 2000
+#define DEFAULT_THREADS 4
+#define MAX_THREADS 64
+#define EVENTS (THREAD_SYNC_RING_SIZE * 200)
+#define ACK_INTERVAL 37
+#define EVENT_STOP 0
+
+static struct thread_sync ts;
+static volatile bool error;
+static int num_barriers;
+
+/* Barrier state, written by leaders only */
+static atomic_ulong generation;
+static atomic_int leading;
+static atomic_int arrivals;
+static atomic_bool churning;
+static int expected_arrivals;   /* 0 if membership changes */
+
+/* Arrives at one barrier and checks the leader/worker contract: exactly one
+ * thread leads each generation, and workers are released only after the
+ * leader is done with it. */
+static void
+barrier(void)
+{
+    uint64_t before = atomic_load(&generation);
+
+    atomic_fetch_add(&arrivals, 1);
+    if (thread_sync_full_barrier(&ts) == THREAD_SYNC_WAIT_LEADER) {
+        if (atomic_exchange(&leading, 1)) {
+            error = true;
+        }
+        if (expected_arrivals &&
+            atomic_exchange(&arrivals, 0) != expected_arrivals) {
+            error = true;
+        }
+        atomic_fetch_add(&generation, 1);
+        atomic_store(&leading, 0);
+        thread_sync_continue(&ts);
+    } else if (atomic_load(&generation) <= before ||
+               atomic_load(&leading)) {
+        error = true;
+    }
+}
+
+/* Registered by "run" before it starts */
+static void*
+worker(void *args)
+{
+    (void)args;
+    for (int i = 0; i < num_barriers; i++) {
+        barrier();
+    }
+    thread_sync_unregister(&ts);
+    return NULL;
+}
+
+/* Registers and unregisters itself every few barriers */
+static void*
+churner(void *args)
+{
+    unsigned int seed = (uintptr_t)args;
+    uint64_t joins = 0;
+
+    while (atomic_load(&churning)) {
+        thread_sync_register(&ts);
+        for (int n = 1 + rand_r(&seed) % 8; n > 0; n--) {
+            barrier();
+        }
+        thread_sync_unregister(&ts);
+        joins++;
+    }
+    return (void*)(uintptr_t)joins;
+}
+
+/* Returns the barrier latency in microseconds. Sets "joins" to the number
+ * of times churners joined. */
+static double
+run(int workers, int churners, uint64_t *joins)
+{
+    pthread_t threads[MAX_THREADS * 2];
+    uint64_t start;
+    double seconds;
+    void *ret;
+
+    thread_sync_init(&ts);
+    atomic_init(&generation, 0);
+    atomic_init(&leading, 0);
+    atomic_init(&arrivals, 0);
+    atomic_init(&churning, true);
+    expected_arrivals = churners ? 0 : workers;
+    *joins = 0;
+
+    for (int i = 0; i < workers; i++) {
+        thread_sync_register(&ts);
+    }
+    start = get_time_ns();
+    for (int i = 0; i < churners; i++) {
+        pthread_create(&threads[workers + i], NULL, churner,
+                       (void*)(uintptr_t)(i + 1));
+    }
+    for (int i = 0; i < workers; i++) {
+        pthread_create(&threads[i], NULL, worker, NULL);
+    }
+    for (int i = 0; i < workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    seconds = (get_time_ns() - start) / 1e9;
+
+    atomic_store(&churning, false);
+    for (int i = 0; i < churners; i++) {
+        pthread_join(threads[workers + i], &ret);
+        *joins += (uintptr_t)ret;
+    }
+
+    /* Churners may add generations, workers never miss one */
+    if (atomic_load(&generation) < (uint64_t)num_barriers ||
+        (!churners && atomic_load(&generation) != (uint64_t)num_barriers)) {
+        error = true;
+    }
+    if (atomic_load(&ts.members)) {
+        error = true;
+    }
+    return seconds * 1e6 / num_barriers;
+}
+
+/* Event ring state. Every event has its version as code, from which the
+ * args are derived. */
+struct subscriber {
+    atomic_ulong handled;       /* Version of the last handled event */
+    bool slow;
+    bool late;                  /* Subscribes after some events */
+};
+
+static atomic_int subscribed;
+
+static uint64_t
+event_args(uint64_t version)
+{
+    return version * 3 + 1;
+}
+
+/* Receives events until EVENT_STOP. Every event must come in version order
+ * and without gaps since subscribing, i.e., none was overwritten in the
+ * ring before being acknowledged. Slow subscribers make the publisher wait
+ * for a free slot. */
+static void*
+subscriber(void *args)
+{
+    struct subscriber *s = args;
+    struct thread_sync_subscriber sub;
+    uint64_t code, arg;
+    uint64_t expected;
+
+    if (s->late) {
+        while (atomic_load(&ts.version) < EVENTS / 4) {
+            sched_yield();
+        }
+    }
+    thread_sync_subscribe(&ts, &sub);
+    expected = atomic_load(&sub.ack) + 1;
+    atomic_store(&s->handled, expected - 1);
+    atomic_fetch_add(&subscribed, 1);
+
+    while (true) {
+        if (!thread_sync_poll(&ts, &sub, &code, &arg)) {
+            sched_yield();
+            continue;
+        }
+        if (code == EVENT_STOP) {
+            break;
+        }
+        if (code != expected || arg != event_args(code)) {
+            error = true;
+        }
+        if (s->slow && !(code % 8)) {
+            sched_yield();
+        }
+        atomic_store(&s->handled, code);
+        expected++;
+    }
+    thread_sync_unsubscribe(&ts, &sub);
+    return NULL;
+}
+
+/* Returns the throughput in millions of events per second */
+static double
+run_events(int subscribers, bool slow)
+{
+    pthread_t threads[MAX_THREADS];
+    struct subscriber subs[MAX_THREADS];
+    uint64_t version;
+    uint64_t start;
+    double seconds;
+
+    thread_sync_init(&ts);
+    atomic_init(&subscribed, 0);
+    for (int i = 0; i < subscribers; i++) {
+        /* Not handled by a late subscriber before it subscribes */
+        atomic_init(&subs[i].handled, UINT64_MAX);
+        subs[i].slow = slow && (i % 2);
+        subs[i].late = i && i == subscribers - 1;
+        pthread_create(&threads[i], NULL, subscriber, &subs[i]);
+    }
+    while (atomic_load(&subscribed) < subscribers - (subscribers > 1)) {
+        sched_yield();
+    }
+
+    start = get_time_ns();
+    for (uint64_t v = 1; v <= EVENTS; v++) {
+        version = thread_sync_publish(&ts, v, event_args(v));
+        if (version != v) {
+            error = true;
+        }
+        if (v == EVENTS / 2) {
+            while (atomic_load(&subscribed) < subscribers) {
+                sched_yield();
+            }
+        }
+        /* All subscribers must be done with "v" */
+        if (!(v % ACK_INTERVAL)) {
+            thread_sync_wait_ack(&ts, v);
+            for (int i = 0; i < subscribers; i++) {
+                if (atomic_load(&subs[i].handled) < v) {
+                    error = true;
+                }
+            }
+        }
+    }
+    version = thread_sync_publish(&ts, EVENT_STOP, 0);
+    for (int i = 0; i < subscribers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    seconds = (get_time_ns() - start) / 1e9;
+
+    for (int i = 0; i < subscribers; i++) {
+        if (atomic_load(&subs[i].handled) != EVENTS) {
+            error = true;
+        }
+    }
+    if (version != EVENTS + 1 || !list_is_empty(&ts.subscribers)) {
+        error = true;
+    }
+    return EVENTS / seconds / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse arguments */
+    for (int i=0; i<argc; i++) {
+        if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i])) {
+            printf("Tests correctness and latency of thread_sync.\n"
+                   "Usage: %s [BARRIERS] [THREADS]\n"
+                   "Runs BARRIERS barriers with every power-of-2 number of "
+                   "workers up to THREADS, without and with as many "
+                   "threads that register and unregister mid-run. Then "
+                   "publishes %d events to every power-of-2 number of "
+                   "subscribers up to THREADS.\n"
+                   "Defaults: %d barriers, %d threads.\n",
+                   argv[0], EVENTS, DEFAULT_BARRIERS, DEFAULT_THREADS);
+            exit(1);
+        }
+    }
+    num_barriers = argc >=2 ? atoi(argv[1]) : DEFAULT_BARRIERS;
+    int threads = argc >=3 ? atoi(argv[2]) : DEFAULT_THREADS;
+    threads = MIN(MAX(threads, 1), MAX_THREADS);
+    num_barriers = MAX(num_barriers, 1);
+
+    printf("%-10s %-10s %-10s %-16s\n",
+           "workers", "churners", "joins", "us/barrier");
+    for (int w=1; w<=threads; w*=2) {
+        for (int c=0; c<=w; c+=w) {
+            uint64_t joins;
+            double us = run(w, c, &joins);
+            printf("%-10d %-10d %-10lu %-16.2lf\n",
+                   w, c, (unsigned long)joins, us);
+        }
+    }
+
+    printf("\n%-12s %-16s %-16s\n",
+           "subscribers", "Mevents/s", "Mevents/s (slow)");
+    for (int s=1; s<=threads; s*=2) {
+        double fast = run_events(s, false);
+        double slow = run_events(s, true);
+        printf("%-12d %-16.2lf %-16.2lf\n", s, fast, slow);
+    }
+
+    /* Check for correctness errors */
+    if (error) {
+        printf("Error: correctness issue\n");
+    }
+
+    return error;
+}
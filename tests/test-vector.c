@@ -0,0 +1,341 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "lib/util.h"
+#include "lib/vector.h"
+#include "lib/perf.h"
+
+#define DEFAULT_ELEMENTS 100000
+#define TEMP_FILE "/tmp/test-vector-XXXXXX"
+
+/* Does not divide the chunk size, so chunks have unused tails */
+struct element {
+    uint32_t index;
+    uint32_t inverse;
+    uint32_t scaled;
+};
+
+static bool error;
+
+static struct element
+element(size_t index)
+{
+    struct element e = { index, ~(uint32_t)index, index * 7 };
+    return e;
+}
+
+static bool
+element_valid(const struct element *e, size_t index)
+{
+    struct element expected = element(index);
+    return !memcmp(e, &expected, sizeof(expected));
+}
+
+/* Pushes elements "from" to "to" - 1 */
+static void
+fill(struct vector *vector, size_t from, size_t to)
+{
+    struct element e;
+
+    for (size_t i = from; i < to; i++) {
+        e = element(i);
+        vector_push(vector, &e);
+    }
+}
+
+/* Checks that "vector" holds exactly elements 0 to "n" - 1, both when
+ * iterating and by index */
+static void
+check(struct vector *vector, size_t n)
+{
+    struct element e;
+    size_t i = 0;
+
+    if (vector_size(vector) != n) {
+        error = true;
+    }
+    VECTOR_FOR_EACH(vector, e, struct element) {
+        if (!element_valid(&e, i)) {
+            error = true;
+        }
+        i++;
+    }
+    if (i != n || vector_get_slow(vector, n)) {
+        error = true;
+    }
+    for (i = 0; i < n; i += 1 + i / 8) {
+        if (!element_valid(vector_get_slow(vector, i), i)) {
+            error = true;
+        }
+    }
+    if (n && !element_valid(vector_get_slow(vector, n - 1), n - 1)) {
+        error = true;
+    }
+}
+
+static int
+compare_pointers(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t)*(void**)a;
+    uintptr_t y = (uintptr_t)*(void**)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Returns the sorted addresses of the first elements of all chunks of
+ * "vector", i.e., elements that do not follow the previous one in memory.
+ * Sets "n" to their number. */
+static void**
+chunks(struct vector *vector, size_t *n)
+{
+    size_t size = vector_size(vector);
+    void **result = xmalloc(sizeof(*result) * MAX(size, 1));
+    char *prev = NULL;
+    char *cur;
+
+    *n = 0;
+    for (size_t i = 0; i < size; i++) {
+        cur = vector_get_slow(vector, i);
+        if (!i || cur != prev + sizeof(struct element)) {
+            result[(*n)++] = cur;
+        }
+        prev = cur;
+    }
+    qsort(result, *n, sizeof(*result), compare_pointers);
+    return result;
+}
+
+/* Refilling after "vector_clear" and "vector_truncate" must reuse the same
+ * chunks, in any order */
+static void
+check_recycled(struct vector *vector, void **expected, size_t n)
+{
+    size_t count;
+    void **current = chunks(vector, &count);
+
+    if (count != n || memcmp(current, expected, sizeof(*current) * n)) {
+        error = true;
+    }
+    free(current);
+}
+
+static void
+test_clear(struct vector *vector, void **original, size_t num_chunks,
+           size_t n)
+{
+    struct element e;
+
+    vector_clear(vector);
+    check(vector, 0);
+    if (vector_pop(vector, &e)) {
+        error = true;
+    }
+    vector_clear(vector);
+    fill(vector, 0, n);
+    check(vector, n);
+    check_recycled(vector, original, num_chunks);
+}
+
+static void
+test_truncate(struct vector *vector, void **original, size_t num_chunks,
+              size_t n)
+{
+    size_t sizes[] = { n + 1, n, n - 1, n / 2 + 1, 1000, 341, 340, 339,
+                       338, 2, 1, 0, 0 };
+
+    size_t size = n;
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+        vector_truncate(vector, sizes[i]);
+        size = MIN(size, sizes[i]);
+        check(vector, size);
+        /* Grow back across the cut, then cut again */
+        fill(vector, size, size + 100);
+        check(vector, size + 100);
+        vector_truncate(vector, size);
+    }
+    fill(vector, size, n);
+    check(vector, n);
+    check_recycled(vector, original, num_chunks);
+}
+
+static void
+test_pop(struct vector *vector, size_t n)
+{
+    struct element e;
+
+    for (size_t i = n; i > 0; i--) {
+        /* Also without copying the element out */
+        if (i % 3) {
+            if (!vector_pop(vector, &e) || !element_valid(&e, i - 1)) {
+                error = true;
+            }
+        } else if (!vector_pop(vector, NULL)) {
+            error = true;
+        }
+        if (vector_size(vector) != i - 1) {
+            error = true;
+        }
+        /* Crossing back into a recycled chunk */
+        if (i == n / 2) {
+            fill(vector, i - 1, i + 499);
+            vector_truncate(vector, i - 1);
+        }
+    }
+    check(vector, 0);
+    if (vector_pop(vector, &e) || vector_pop(vector, NULL)) {
+        error = true;
+    }
+}
+
+/* Saves "vector" to a new temporary file, whose path is written to "path",
+ * then maps it back */
+static struct vector*
+save_map(struct vector *vector, char *path)
+{
+    struct vector *mapped;
+    int fd;
+
+    strcpy(path, TEMP_FILE);
+    fd = mkstemp(path);
+    if (fd < 0 || vector_save(vector, fd)) {
+        abort_msg("cannot save vector");
+    }
+    close(fd);
+    mapped = vector_map(path);
+    if (!mapped || vector_elem_size(mapped) != vector_elem_size(vector)) {
+        error = true;
+    }
+    return mapped;
+}
+
+/* Expects "vector_map" to reject "path" with "err" */
+static void
+check_map_fails(const char *path, int err)
+{
+    struct vector *mapped;
+
+    errno = 0;
+    mapped = vector_map(path);
+    if (mapped || errno != err) {
+        error = true;
+        vector_destroy(mapped);
+    }
+}
+
+/* Round trips "vector", which holds elements 0 to "n" - 1, through
+ * "vector_save" and "vector_map", also saving a mapped vector. Then checks
+ * that corrupt files are rejected. */
+static void
+test_save_map(struct vector *vector, size_t n)
+{
+    char path[sizeof(TEMP_FILE)];
+    char path2[sizeof(TEMP_FILE)];
+    struct vector *mapped, *mapped2;
+    struct vector *empty;
+    uint64_t magic;
+    off_t size;
+    int fd;
+
+    mapped = save_map(vector, path);
+    check(mapped, n);
+    mapped2 = save_map(mapped, path2);
+    check(mapped2, n);
+    vector_destroy(mapped2);
+    vector_destroy(mapped);
+    unlink(path2);
+
+    empty = vector_init(sizeof(struct element));
+    mapped = save_map(empty, path2);
+    check(mapped, 0);
+    vector_destroy(mapped);
+    vector_destroy(empty);
+    unlink(path2);
+
+    /* Missing elements, wrong magic, no complete header, no file */
+    fd = open(path, O_RDWR);
+    size = lseek(fd, 0, SEEK_END);
+    if (ftruncate(fd, size - 1)) {
+        abort_msg("ftruncate fail");
+    }
+    check_map_fails(path, EINVAL);
+    magic = 0;
+    if (pwrite(fd, &magic, sizeof(magic), 0) != sizeof(magic) ||
+        ftruncate(fd, size)) {
+        abort_msg("cannot corrupt file");
+    }
+    check_map_fails(path, EINVAL);
+    if (ftruncate(fd, 8)) {
+        abort_msg("ftruncate fail");
+    }
+    check_map_fails(path, EINVAL);
+    close(fd);
+    unlink(path);
+    check_map_fails(path, ENOENT);
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse arguments */
+    for (int i=0; i<argc; i++) {
+        if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i])) {
+            printf("Tests correctness of vector.\n"
+                   "Usage: %s [ELEMENTS]\n"
+                   "Fills a vector with ELEMENTS elements, then clears, "
+                   "truncates, saves, maps and pops it.\n"
+                   "Defaults: %d elements.\n",
+                   argv[0], DEFAULT_ELEMENTS);
+            exit(1);
+        }
+    }
+    size_t n = argc >=2 ? atol(argv[1]) : DEFAULT_ELEMENTS;
+    n = MAX(n, 2000);
+
+    struct vector *vector = vector_init(sizeof(struct element));
+    size_t num_chunks;
+    void **original;
+    uint64_t start;
+
+    printf("%-16s %-10s\n", "operation", "ms");
+
+    start = get_time_ns();
+    fill(vector, 0, n);
+    check(vector, n);
+    original = chunks(vector, &num_chunks);
+    printf("%-16s %-10.2lf\n", "fill", (get_time_ns() - start) / 1e6);
+
+    start = get_time_ns();
+    test_clear(vector, original, num_chunks, n);
+    printf("%-16s %-10.2lf\n", "clear", (get_time_ns() - start) / 1e6);
+
+    start = get_time_ns();
+    test_truncate(vector, original, num_chunks, n);
+    printf("%-16s %-10.2lf\n", "truncate", (get_time_ns() - start) / 1e6);
+
+    start = get_time_ns();
+    test_save_map(vector, n);
+    printf("%-16s %-10.2lf\n", "save and map", (get_time_ns() - start) / 1e6);
+
+    start = get_time_ns();
+    test_pop(vector, n);
+    printf("%-16s %-10.2lf\n", "pop", (get_time_ns() - start) / 1e6);
+
+    /* Without recycled chunks */
+    vector_shrink(vector);
+    fill(vector, 0, n);
+    check(vector, n);
+
+    free(original);
+    vector_destroy(vector);
+
+    /* Check for correctness errors */
+    if (error) {
+        printf("Error: correctness issue\n");
+    }
+
+    return error;
+}
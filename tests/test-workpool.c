@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "lib/util.h"
+#include "lib/ws-deque.h"
+#include "lib/workpool.h"
+#include "lib/perf.h"
+
+#define DEFAULT_ELEMENTS 100000
+#define DEFAULT_THREADS 4
+#define MAX_THREADS 64
+#define DEQUE_SIZE 1024
+#define DEQUE_ITEMS 200000
+
+static volatile bool error;
+
+/* Work-stealing deque: the owner pushes and pops while thieves steal. Every
+ * item must be taken exactly once. */
+static struct ws_deque deque;
+static atomic_uchar *taken;
+static atomic_bool owner_done;
+
+static void
+take(void *item)
+{
+    uintptr_t i = (uintptr_t)item;
+
+    if (!i || i > DEQUE_ITEMS || atomic_fetch_add(&taken[i - 1], 1)) {
+        error = true;
+    }
+}
+
+static void*
+thief(void *args)
+{
+    uint64_t *stolen = args;
+    void *item;
+
+    while (true) {
+        item = ws_deque_steal(&deque);
+        if (item) {
+            take(item);
+            (*stolen)++;
+        } else if (atomic_load(&owner_done) && !ws_deque_size(&deque)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Returns the number of items stolen */
+static uint64_t
+run_deque(int thieves)
+{
+    pthread_t threads[MAX_THREADS];
+    uint64_t stolen[MAX_THREADS];
+    uint64_t total = 0;
+    uintptr_t next = 1;
+    void *item;
+
+    ws_deque_init(&deque, DEQUE_SIZE);
+    taken = xmalloc(sizeof(*taken) * DEQUE_ITEMS);
+    for (int i = 0; i < DEQUE_ITEMS; i++) {
+        atomic_init(&taken[i], 0);
+    }
+    atomic_init(&owner_done, false);
+
+    for (int i = 0; i < thieves; i++) {
+        stolen[i] = 0;
+        pthread_create(&threads[i], NULL, thief, &stolen[i]);
+    }
+
+    /* Pushes in bursts, pops a part of each burst, and leaves the rest to
+     * thieves, so that pops also race for the last items */
+    while (next <= DEQUE_ITEMS) {
+        int burst = 1 + next % 17;
+        for (int i = 0; i < burst && next <= DEQUE_ITEMS; i++) {
+            if (!ws_deque_push(&deque, (void*)next)) {
+                break;
+            }
+            next++;
+        }
+        for (int i = 0; i < burst / 2; i++) {
+            item = ws_deque_pop(&deque);
+            if (item) {
+                take(item);
+            }
+        }
+    }
+    while ((item = ws_deque_pop(&deque))) {
+        take(item);
+    }
+    atomic_store(&owner_done, true);
+
+    for (int i = 0; i < thieves; i++) {
+        pthread_join(threads[i], NULL);
+        total += stolen[i];
+    }
+    for (int i = 0; i < DEQUE_ITEMS; i++) {
+        if (atomic_load(&taken[i]) != 1) {
+            error = true;
+        }
+    }
+    if (ws_deque_pop(&deque) || ws_deque_steal(&deque)) {
+        error = true;
+    }
+
+    free(taken);
+    ws_deque_destroy(&deque);
+    return total;
+}
+
+/* Parallel for: every element of the range must be visited exactly once,
+ * and none outside of it */
+struct for_args {
+    atomic_uchar *visits;
+    atomic_ulong sum;
+};
+
+static void
+visit(size_t begin, size_t end, void *args_)
+{
+    struct for_args *args = args_;
+    uint64_t sum = 0;
+
+    if (begin >= end) {
+        error = true;
+    }
+    for (size_t i = begin; i < end; i++) {
+        atomic_fetch_add(&args->visits[i], 1);
+        sum += i;
+    }
+    atomic_fetch_add(&args->sum, sum);
+}
+
+/* Returns the elapsed time in milliseconds */
+static double
+run_for(struct workpool *pool, size_t begin, size_t end, size_t grain)
+{
+    struct for_args args;
+    uint64_t expected = 0;
+    uint64_t start;
+    double ms;
+
+    args.visits = xmalloc(sizeof(*args.visits) * (end + 1));
+    for (size_t i = 0; i <= end; i++) {
+        atomic_init(&args.visits[i], 0);
+    }
+    atomic_init(&args.sum, 0);
+
+    start = get_time_ns();
+    workpool_parallel_for(pool, begin, end, grain, visit, &args);
+    ms = (get_time_ns() - start) / 1e6;
+
+    for (size_t i = 0; i <= end; i++) {
+        if (atomic_load(&args.visits[i]) != (i >= begin && i < end)) {
+            error = true;
+        }
+        if (i >= begin && i < end) {
+            expected += i;
+        }
+    }
+    if (atomic_load(&args.sum) != expected) {
+        error = true;
+    }
+
+    free(args.visits);
+    return ms;
+}
+
+int main(int argc, char **argv)
+{
+    /* Parse arguments */
+    for (int i=0; i<argc; i++) {
+        if (!strcmp("--help", argv[i]) || !strcmp("-h", argv[i])) {
+            printf("Tests correctness of ws_deque and workpool.\n"
+                   "Usage: %s [ELEMENTS] [THREADS]\n"
+                   "Runs ws_deque stealing and workpool_parallel_for with "
+                   "every power-of-2 number of threads up to THREADS.\n"
+                   "Defaults: %d elements, %d threads.\n",
+                   argv[0], DEFAULT_ELEMENTS, DEFAULT_THREADS);
+            exit(1);
+        }
+    }
+    size_t elements = argc >=2 ? atol(argv[1]) : DEFAULT_ELEMENTS;
+    int threads = argc >=3 ? atoi(argv[2]) : DEFAULT_THREADS;
+    threads = MIN(MAX(threads, 1), MAX_THREADS);
+    elements = MAX(elements, 1);
+
+    printf("%-10s %-16s\n", "thieves", "stolen items");
+    for (int t=1; t<=threads; t*=2) {
+        printf("%-10d %-16lu\n", t, (unsigned long)run_deque(t));
+    }
+
+    size_t grains[] = { 1, 7, 64, 1000, elements };
+    size_t offsets[] = { 0, 3 };
+    printf("\n%-10s %-10s %-10s %-10s %-10s\n",
+           "threads", "begin", "end", "grain", "ms");
+    for (int t=1; t<=threads; t*=2) {
+        struct workpool *pool = workpool_create(t);
+        if (workpool_size(pool) != t) {
+            error = true;
+        }
+        for (size_t o=0; o<sizeof(offsets)/sizeof(*offsets); o++) {
+            for (size_t g=0; g<sizeof(grains)/sizeof(*grains); g++) {
+                size_t begin = offsets[o];
+                size_t end = begin + elements - o;
+                double ms = run_for(pool, begin, end, grains[g]);
+                printf("%-10d %-10zu %-10zu %-10zu %-10.2lf\n",
+                       t, begin, end, grains[g], ms);
+            }
+        }
+        /* Empty and single-element ranges */
+        run_for(pool, 5, 5, 1);
+        run_for(pool, 5, 6, 64);
+        workpool_destroy(pool);
+    }
+
+    /* Check for correctness errors */
+    if (error) {
+        printf("Error: correctness issue\n");
+    }
+
+    return error;
+}